@@ -217,6 +217,12 @@ SECTIONS
 	__start_UART_TABLE = . ;
 	*(UART_TABLE)
 	__stop_UART_TABLE = . ;
+  } AT> text_window
+  LOG_TABLE ADDR(UART_TABLE) + SIZEOF (UART_TABLE) :
+  {
+	__start_LOG_TABLE = . ;
+	*(LOG_TABLE)
+	__stop_LOG_TABLE = . ;
 	__stop_text_window = . ;
   } AT> text_window
   .data          :
@@ -38,11 +38,30 @@
 // System Tick timer
 #define SYS_TICK_TIMER  SYS_TIMER_TCB0	// System tick clock source (Timer/Counter type B)
 #define SYS_TICK_FREQ	1000			// System tick clock frequency in Hz
+// Stop the system tick while idle and sleep in standby on the RTC until the
+// next state machine tick wait is due
+//#define SYS_TICKLESS
+// Record scheduler, event, queue and interrupt activity in a RAM ring buffer
+// for the "trace" CLI command and util/trace2json
+//#define SYS_TRACE
+#define TRC_BUFFER_SIZE	128			// Number of trace records (10 bytes each)
+// Keep a crash record in RAM that survives reset, reported at the next boot and
+// by the "crash" CLI command after a critical error, watchdog or brown-out reset
+#define SYS_CRASH
+#define CRASH_LOG_SIZE	8			// Number of recent log messages kept (7 bytes each)
+// Also keep the crash record in EEPROM, so it survives a power cycle
+//#define CRASH_EEPROM
+// Replace printf() and fprintf() with the integer only fioPrintf(), which
+// formats straight into the output queue of the file. This applies to every
+// file that includes avrOS.h, and %f and the other floating point conversions
+// only print a ?
+//#define FIO_PRINTF
 
 // Logger Configuration -------------------------------------------------------
-#define LOG_QUEUE_SIZE		255
+#define LOG_QUEUE_SIZE		2048		// Power of 2 up to QUE_MAX_SIZE (32K)
+#define LOG_RECORD_QUEUE_SIZE	512		// Bytes of deferred log records (LOG_FORMAT 5), even
 #define LOG_USART			USART1
-#define LOG_BAUDRATE		115200
+#define LOG_BAUDRATE		115200		// CPU clock/16384 up to CPU clock/8, e.g. 1465 to 3000000 at 24 MHz
 #define LOG_PARITY			USART_PMODE_DISABLED_gc	// USART_PMODE_DISABLED_gc = No Parity
 													// USART_PMODE_EVEN_gc = Even Parity
 													// USART_PMODE_ODD_gc = Odd Parity
@@ -68,15 +87,22 @@
 						// 2 = System Tick: Level: Message
 						// 3 = System Tick: Level: Curr State Machine: Curr State: Message
 						// 4 = System Tick: Level: Src Function: Src Line: Message
+						// 5 = Deferred, binary records formatted on the host by util/log2txt
+// Limit the rate of each log call site with a token bucket on the system tick,
+// and count repeats of the last message instead of logging them
+#define LOG_RATE_LIMIT
+#define LOG_BURST			5		// Messages a call site can log in a burst
+#define LOG_RATE_TICKS		1000	// Ticks for a call site to earn back one message
+#define LOG_REPEAT_TICKS	10000	// Repeats within this many ticks of the last message logged are only counted
 // Logger Constants
 #define LOG_BANNER		CLEAR_SCREEN CURSOR_HOME RESET FG_CYAN BOLD "\r*** avrOS Logger Starting ***\n\r" RESET
 #define DISPLAY_PROMPT	FG_GREEN "\ravrOS> " RESET
 
 // CLI Configuration -----------------------------------------------------------------
 #define CLI_RX_QUEUE_SIZE	8
-#define CLI_TX_QUEUE_SIZE	1024
+#define CLI_TX_QUEUE_SIZE	1024		// Power of 2 up to QUE_MAX_SIZE (32K)
 #define CLI_USART     USART2
-#define CLI_BAUDRATE  115200
+#define CLI_BAUDRATE  115200		// CPU clock/16384 up to CPU clock/8, e.g. 1465 to 3000000 at 24 MHz
 #define CLI_PARITY    USART_PMODE_DISABLED_gc // USART_PMODE_DISABLED_gc = No Parity
 											  // USART_PMODE_EVEN_gc = Even Parity
 											  // USART_PMODE_ODD_gc = Odd Parity
@@ -103,12 +129,16 @@
 #define CPU_CLI		// CPU commands
 #define EVNT_CLI    // Event commands
 #define GPIO_CLI    // GPIO commands
+#define TMR_CLI		// Timer commands
+#define LOG_CLI		// Logger commands
 // Enabling stats also includes string names used by associated CLI commands
 #define FSM_STATS	    // Include string names of state machines and states
 #define UART_STATS		// Calculate and track uart statistics, requires additional RAM and CPU cycles
 #define QUE_STATS		// Calculate and track queue statistics, requires additional RAM and CPU cycles
 #define EVNT_STATS      // Calculate and track event statistics
 #define GPIO_STATS		// Calculate and track GPIO statistics
+#define TMR_STATS		// Calculate and track timer statistics
+#define FSM_PROF		// Profile state machine and state CPU time, requires additional RAM and CPU cycles
 #else
 #undef UART_CLI		// Uart driver CLI commands
 #undef QUE_CLI		// Queue service commands
@@ -120,12 +150,16 @@
 #undef CPU_CLI		// CPU commands
 #undef EVNT_CLI		// Event commands
 #undef GPIO_CLI		// GPIO commands
+#undef TMR_CLI		// Timer commands
+#undef LOG_CLI		// Logger commands
 // Enabling stats also includes string names used by associated CLI commands
 #undef FSM_STATS	    // Include string names of state machines and states
 #undef UART_STATS		// Calculate and track uart statistics, requires additional RAM and CPU cycles
 #undef QUE_STATS		// Calculate and track queue statistics, requires additional RAM and CPU cycles
 #undef EVNT_STATS      // Calculate and track event statistics
 #undef GPIO_STATS		// Calculate and track GPIO statistics
+#undef TMR_STATS		// Calculate and track timer statistics
+#undef FSM_PROF		// Profile state machine and state CPU time, requires additional RAM and CPU cycles
 #endif
 
 // CLI constants
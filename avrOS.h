@@ -50,6 +50,10 @@
 #include "sys/fsm.h"
 #include "sys/event.h"
 #include "sys/queue.h"
+#include "sys/message.h"
+#include "sys/timer.h"
+#include "sys/trace.h"
+#include "sys/crash.h"
 #include "srv/log.h"
 #include "sys/fio.h"
 
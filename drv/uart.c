@@ -30,41 +30,74 @@ static UART_t *gsUart0 = NULL, *gsUart1 = NULL, *gsUart2 = NULL;
 // Internal Function Prototypes -----------------------------------------------
 static void isrUsartDRE(UART_t *uart);
 static void isrUsartRXC(UART_t *uart);
+#ifdef SYS_TICKLESS
+static void isrUsartTXC(UART_t *uart);
+#endif
+static void uartRxIdle(volatile timer_t *timer);
 
 // Interrupt Table Hooks ------------------------------------------------------
 // Hook the USART0 Data Register Empty interrupt handler
 ISR(USART0_DRE_vect)
 {
+    TRACE_ISR(USART0_DRE_vect_num);
     if(gsUart0 != NULL)
         isrUsartDRE(gsUart0);
 }
 // Hook the USART1 Data Register Empty interrupt handler
 ISR(USART1_DRE_vect)
 {
+    TRACE_ISR(USART1_DRE_vect_num);
     if(gsUart1 != NULL)
         isrUsartDRE(gsUart1);
 }
 // Hook the USART2 Data Register Empty interrupt handler
 ISR(USART2_DRE_vect)
 {
+    TRACE_ISR(USART2_DRE_vect_num);
     if(gsUart2 != NULL)
         isrUsartDRE(gsUart2);
 }
+#ifdef SYS_TICKLESS
+// Hook the USART0 Transmit Complete interrupt handler
+ISR(USART0_TXC_vect)
+{
+    TRACE_ISR(USART0_TXC_vect_num);
+    if(gsUart0 != NULL)
+        isrUsartTXC(gsUart0);
+}
+// Hook the USART1 Transmit Complete interrupt handler
+ISR(USART1_TXC_vect)
+{
+    TRACE_ISR(USART1_TXC_vect_num);
+    if(gsUart1 != NULL)
+        isrUsartTXC(gsUart1);
+}
+// Hook the USART2 Transmit Complete interrupt handler
+ISR(USART2_TXC_vect)
+{
+    TRACE_ISR(USART2_TXC_vect_num);
+    if(gsUart2 != NULL)
+        isrUsartTXC(gsUart2);
+}
+#endif
 // Hook the USART0 Receive Complete interrupt handler
 ISR(USART0_RXC_vect)
 {
+    TRACE_ISR(USART0_RXC_vect_num);
     if(gsUart0 != NULL)
         isrUsartRXC(gsUart0);
 }
 // Hook the USART1 Receive Complete interrupt handler
 ISR(USART1_RXC_vect)
 {
+    TRACE_ISR(USART1_RXC_vect_num);
     if(gsUart1 != NULL)
         isrUsartRXC(gsUart1);
 }
 // Hook the USART2 Receive Complete interrupt handler
 ISR(USART2_RXC_vect)
 {
+    TRACE_ISR(USART2_RXC_vect_num);
     if(gsUart2 != NULL)
         isrUsartRXC(gsUart2);
 }
@@ -73,10 +106,32 @@ ISR(USART2_RXC_vect)
 // USART Data Register Empty (Tx) interrupt handler
 static void isrUsartDRE(UART_t *uart)
 {
-    uint8_t		txByte;
+    volatile uartTx_t   *tx = uart->tx;
+    uint8_t		        txByte;
     
-    // If there are more bytes in the transmit queue...
-    if(queGet(uart->txQueue,(char *)&txByte))
+    // If bytes queued before the uartWrite() buffer are left to send...
+    if(tx->queued && queGet(uart->txQueue,(char *)&txByte))
+    {
+        --tx->queued;
+        uart->usartRegs->TXDATAL = txByte;
+#ifdef UART_STATS
+        ++uart->stats->txBytes;
+#endif
+    }
+    // Else if a uartWrite() is in progress, send straight from the caller's buffer
+    else if(tx->remaining)
+    {
+        tx->queued = 0;
+        uart->usartRegs->TXDATAL = *tx->buffer++;
+#ifdef UART_STATS
+        ++uart->stats->txBytes;
+#endif
+        // If that was the last byte, the caller can reuse the buffer
+        if(--tx->remaining == 0)
+            evntTrigger(uart->event,UART_EVENT_TX_DONE);
+    }
+    // Else if there are more bytes in the transmit queue...
+    else if(uart->txQueue != NULL && queGet(uart->txQueue,(char *)&txByte))
     {
          uart->usartRegs->TXDATAL = txByte;
 #ifdef UART_STATS
@@ -86,11 +141,33 @@ static void isrUsartDRE(UART_t *uart)
     // Else transmit queue is empty...
     else
     {
+#ifdef SYS_TICKLESS
+        // Clear the transmit complete flag before the last byte completes
+        uart->usartRegs->STATUS = USART_TXCIF_bm;
+        // Disable the tx data register empty interrupt and wait for the last
+        // byte to shift out before releasing the sleep lock
+        uart->usartRegs->CTRLA = (uart->usartRegs->CTRLA & ~USART_DREIE_bm) | USART_TXCIE_bm;
+#else
         // Disable the tx data register empty interrupt
         uart->usartRegs->CTRLA &= ~USART_DREIE_bm;
+#endif
     }
 }
 
+#ifdef SYS_TICKLESS
+// USART Transmit Complete (Tx) interrupt handler
+static void isrUsartTXC(UART_t *uart)
+{
+    // Clear the interrupt
+    uart->usartRegs->STATUS = USART_TXCIF_bm;
+    // Disable the tx complete interrupt
+    uart->usartRegs->CTRLA &= ~USART_TXCIE_bm;
+    // If transmit has not been restarted, the main clock can stop in sleep
+    if(!(uart->usartRegs->CTRLA & USART_DREIE_bm))
+        sysSleepUnlock();
+}
+#endif
+
 // USART Receive Complete (Rx) interrupt handler
 static void isrUsartRXC(UART_t *uart)
 {
@@ -98,15 +175,24 @@ static void isrUsartRXC(UART_t *uart)
     
     if(error == USART_RXCIF_bm)
     {
-#ifdef UART_STATS
         bool queued = quePutByte(uart->rxQueue,uart->usartRegs->RXDATAL);
+#ifdef UART_STATS
         if(queued)
             ++uart->stats->rxBytes;
         else
             ++uart->stats->rxQueueOverflow;
-#else
-        quePutByte(uart->rxQueue,uart->usartRegs->RXDATAL);
 #endif
+        // If receive framing is on, the byte extends the frame in progress
+        if(queued && uart->rx->gapTicks)
+        {
+            volatile uartRx_t   *rx = uart->rx;
+
+            rx->lastTick = sysGetTickCount();
+            // Only the first byte of a frame starts the idle timer. The rest
+            // just move lastTick, so the timer isn't relinked for every byte
+            if(rx->current++ == 0)
+                tmrStart(rx->idle,rx->gapTicks,0);
+        }
     }
 #ifdef UART_STATS
     else if(error&USART_PERR_bm)
@@ -118,6 +204,47 @@ static void isrUsartRXC(UART_t *uart)
 #endif
 }
 
+// Idle line timer callback. If the line has been idle for the gap since the
+// last byte, the frame in progress is complete. Else wait out the rest of it
+static void uartRxIdle(volatile timer_t *timer)
+{
+    UART_t              *uart = (UART_t *)&__start_UART_TABLE;
+    volatile uartRx_t   *rx;
+    bool                complete = false;
+
+    // Find the uart that owns the timer
+    while(uart < (UART_t *)&__stop_UART_TABLE && (uart->rx == NULL || uart->rx->idle != timer))
+        ++uart;
+    if(uart >= (UART_t *)&__stop_UART_TABLE)
+        return;
+    rx = uart->rx;
+
+    // Start critical section of code
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        uint32_t    elapsed = sysGetTickCount() - rx->lastTick;
+
+        // If framing was turned off since the timer started, there's no frame
+        if(!rx->current)
+            ;
+        else if(elapsed >= rx->gapTicks)
+        {
+            // If the list of complete frames is full, join the newest frame
+            if(rx->count == UART_RX_FRAMES)
+                rx->frames[(rx->first + UART_RX_FRAMES - 1) % UART_RX_FRAMES] += rx->current;
+            else
+                rx->frames[(rx->first + rx->count++) % UART_RX_FRAMES] = rx->current;
+            rx->current = 0;
+            complete = true;
+        }
+        else
+            tmrStart(timer,rx->gapTicks - elapsed,0);
+    } // End critical section
+
+    if(complete)
+        evntTrigger(uart->event,UART_EVENT_RX_FRAME);
+}
+
 // Command Line Interface -----------------------------------------------------
 #ifdef UART_CLI
 ADD_COMMAND("uart",uartCmd,true);
@@ -141,14 +268,27 @@ int uartCmd(int argc, char *argv[])
 #else
             printf(BOLD UNDERLINE FG_BLUE "%s",name);
 #endif
-            printf("   %lu:%c:%d:%d\n\r" RESET,(uint32_t)uart->baud*100,
+            printf("   %lu:%c:%d:%d\n\r" RESET,uart->baud,
                                         uart->parity==USART_PMODE_DISABLED_gc?'N':uart->parity==USART_PMODE_EVEN_gc?'E':uart->parity==USART_PMODE_ODD_gc?'O':'?',
                                         uart->dataBits==USART_CHSIZE_5BIT_gc?(uint8_t)5:uart->dataBits==USART_CHSIZE_6BIT_gc?(uint8_t)6:uart->dataBits==USART_CHSIZE_7BIT_gc?(uint8_t)7:uart->dataBits==USART_CHSIZE_8BIT_gc?(uint8_t)8:uart->dataBits==USART_CHSIZE_9BITL_gc?(uint8_t)9:uart->dataBits==USART_CHSIZE_9BITH_gc?(uint8_t)9:0,
                                         uart->stopBits==USART_SBMODE_1BIT_gc?(uint8_t)1:uart->stopBits==USART_SBMODE_2BIT_gc?(uint8_t)2:0);
+            // Actual baud rate and its error from the requested rate in 0.01%
+            uint32_t    actual = uartGetBaud(uart);
+            int32_t     error = actual ? ((int32_t)(actual - uart->baud))*10000/(int32_t)uart->baud : 0;
+            uint32_t    magnitude = error < 0 ? -error : error;
+            printf("\tActual Baud:%10lu Error:%c%lu.%02lu%%%s\n\r",actual,error<0?'-':'+',magnitude/100,magnitude%100,
+                   (uart->usartRegs->CTRLB & USART_RXMODE_gm) == USART_RXMODE_CLK2X_gc ? " CLK2X" : "");
 #ifdef UART_STATS
             printf("\tTx:%14lu Rx:%20lu Frame Err:%12lu Parity Err:%8lu\n\r",uart->stats->txBytes,uart->stats->rxBytes,uart->stats->frameError,uart->stats->parityError);
             printf("\tTxOvrflw:%8lu RxBufferOvrflw:%8lu RxQueueOvrflw:%8lu\n\r",uart->stats->txQueueOverflow,uart->stats->rxBufferOverflow,uart->stats->rxQueueOverflow);
 #endif
+            if(uart->txQueue != NULL)
+                printf("\tTxQue:%6u/%-6u Max:%6u",uartTxSize(uart),uartTxCapacity(uart),uartTxMax(uart));
+            if(uart->rxQueue != NULL)
+                printf("\tRxQue:%6u/%-6u Max:%6u",uartRxSize(uart),uartRxCapacity(uart),uartRxMax(uart));
+            printf("\n\r");
+            if(uart->rx != NULL && uart->rx->gapTicks)
+                printf("\tRx Frames:%4u Gap:%6u ticks\n\r",uart->rx->count,uart->rx->gapTicks);
             ret = 0;
         }
     }
@@ -165,7 +305,9 @@ int uartInit(const fsmStateMachineDescr_t *stateMachineDescr)
     UART_t      *uartInstance = (UART_t *)initGetInstance(stateMachineDescr);
     USART_t		*usartRegs = uartInstance->usartRegs;
     int8_t		ret = 0;
-    uint16_t	freq = cpuGetFrequency();
+    uint32_t	freq = (uint32_t)cpuGetFrequency()*1000;
+    uint32_t	baud = uartInstance->baud;
+    uint8_t		rxMode = USART_RXMODE_NORMAL_gc;
 
 #ifdef UART_STATS
     // Zero out the interface stats
@@ -177,10 +319,28 @@ int uartInit(const fsmStateMachineDescr_t *stateMachineDescr)
  //   {
         // If the CPU frequency is calculable...
         if(freq)
-            usartRegs->BAUD = ((freq/uartInstance->baud*10)<<2);
+        {
+            // BAUD = 64*fCLK/(S*fBAUD), rounded to the nearest. Use 16 samples
+            // per bit (S=16) if the BAUD register can reach the minimum of 64,
+            // else double speed (S=8). From fCLK/16384 up to fCLK/16 or fCLK/8
+            // baud
+            if(baud == 0 || (4*freq + baud/2)/baud > 0xffff)
+                // The baud rate is too slow for the 16 bit BAUD register
+                ret = -1;
+            else if(baud <= freq/16)
+                usartRegs->BAUD = (4*freq + baud/2)/baud;
+            else if(baud <= freq/8)
+            {
+                usartRegs->BAUD = (8*freq + baud/2)/baud;
+                rxMode = USART_RXMODE_CLK2X_gc;
+            }
+            // Else the baud rate is too fast for the CPU clock
+            else
+                ret = -1;
+        }
         // Else baud is the baud register value
         else
-            usartRegs->BAUD = uartInstance->baud;
+            usartRegs->BAUD = baud;
 
         // Set the mode as async and frame format as specified
         usartRegs->CTRLC = USART_CMODE_ASYNCHRONOUS_gc | uartInstance->parity | uartInstance->stopBits | uartInstance->dataBits;
@@ -220,9 +380,17 @@ int uartInit(const fsmStateMachineDescr_t *stateMachineDescr)
             // If Rx queues exist, enable Rx interrupts
             if(uartInstance->rxQueue!=NULL)
                 usartRegs->CTRLA |= USART_RXCIE_bm;
-
-            // Enable the Tx, Rx, and standard Rx mode (16 over samples)
-            usartRegs->CTRLB |= USART_RXEN_bm | USART_TXEN_bm | USART_RXMODE_NORMAL_gc;
+            // Hook the idle line timer used by receive framing
+            if(uartInstance->rx!=NULL)
+                tmrSetCallback(uartInstance->rx->idle,uartRxIdle);
+
+            // Enable the Tx, Rx, and Rx mode (16 or 8 samples)
+            usartRegs->CTRLB = (usartRegs->CTRLB & ~USART_RXMODE_gm) | USART_RXEN_bm | USART_TXEN_bm | rxMode;
+#ifdef SYS_TICKLESS
+            // Enable start of frame detection so Rx can wake from standby
+            if(uartInstance->rxQueue!=NULL)
+                usartRegs->CTRLB |= USART_SFDEN_bm;
+#endif
         }
 //    }
     
@@ -260,6 +428,33 @@ int uartGetChar(FILE *stream)
     return(ret);
 }
 
+// Enable the tx data register empty interrupt to start transmitting
+static void uartStartTx(const UART_t *uart)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+#ifdef SYS_TICKLESS
+        // If the transmitter was idle, keep the main clock running in sleep
+        // until the transmit completes
+        if(!(uart->usartRegs->CTRLA & (USART_DREIE_bm | USART_TXCIE_bm)))
+            sysSleepLock();
+#endif
+        uart->usartRegs->CTRLA |= USART_DREIE_bm;
+    }
+}
+
+// Start sending the bytes fioPrintf() wrote straight into the transmit queue
+void uartStartOutput(FILE *stream, uint16_t dropped)
+{
+    UART_t	*uart = (UART_t *)fdev_get_udata(stream);
+
+#ifdef UART_STATS
+    if(dropped)
+        ++uart->stats->txQueueOverflow;
+#endif
+    uartStartTx(uart);
+}
+
 // Load the uart transmit queue with the number of bytes specified. If 
 // byteCount is greater than the size of the queue remaining, the queue
 // is filled and the number of bytes loaded into the queue is returned.
@@ -271,21 +466,22 @@ int uartTransmit(const UART_t *uart, char *buffer, size_t byteCount)
     // If there is a transmit queue...
     if(uart->txQueue != NULL)
      {
-        for(;i<byteCount;++i)
+        // Copy as much of the buffer as fits in the queue
+        i = quePutN(uart->txQueue,buffer,byteCount);
+        // If the buffer is full...
+        if(i < byteCount)
         {
-            // If the buffer is full...
-            if(!quePutByte(uart->txQueue,buffer[i]))
-            {
 #ifdef UART_STATS
-                // Increment the buffer overflow counter
-                ++uart->stats->txQueueOverflow;
+            // Increment the buffer overflow counter
+            ++uart->stats->txQueueOverflow;
 #endif				
+            // Don't log the error to the log UART itself, that would recurse
+            // back into this full queue
+            if(uart->file != stderr)
                 ERROR("UART xmit buffer full");
-                break;
-            }
         }
         // Enable the tx data register empty interrupt
-        uart->usartRegs->CTRLA |= USART_DREIE_bm;
+        uartStartTx(uart);
     }
     // Else there is no transmit queue...
     else
@@ -299,6 +495,43 @@ int uartTransmit(const UART_t *uart, char *buffer, size_t byteCount)
     return(i);
 }
 
+// Start sending length bytes straight from buffer and return. The bytes go out
+// after any bytes already in the transmit queue. The buffer must not change
+// until UART_EVENT_TX_DONE is triggered on uartGetEvent(uart), so constant
+// strings and large buffers are sent without copying them to the queue
+// Return: False if a previous uartWrite() is still in progress
+bool uartWrite(const UART_t *uart, const void *buffer, uint16_t length)
+{
+    volatile uartTx_t   *tx = uart->tx;
+    bool                ret = false;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if(!tx->remaining)
+        {
+            if(length)
+            {
+                tx->queued = uart->txQueue != NULL ? queGetSize(uart->txQueue) : 0;
+                tx->buffer = buffer;
+                tx->remaining = length;
+                uartStartTx(uart);
+            }
+            else
+                evntTrigger(uart->event,UART_EVENT_TX_DONE);
+            ret = true;
+        }
+    }
+    return(ret);
+}
+
+// Wait until the transmit queue has room for count bytes. Doesn't wait if it
+// already does. Use when uartTransmit() returns less than was requested
+void uartWaitTxSpace(const UART_t *uart, uint16_t count)
+{
+    if(uart->file != NULL && uart->txQueue != NULL)
+        fioWaitOutputSpace((FILE *)uart->file,count);
+}
+
 int uartTransmitStr(const UART_t *uart, char *str)
 {
     return(uartTransmit(uart,str,strlen(str)));
@@ -322,22 +555,8 @@ int uartReceive(const UART_t *uart, char *buffer, size_t byteCount)
 
     // If the UART has an RX queue...
     if(uart->rxQueue != NULL)
-    {
-        // Up to byteCount times...
-        for(;i<byteCount;++i)
-        {
-            char ch;
-            
-            // If there is a byte in the queue...
-            if(queGet(uart->rxQueue,&ch))
-                // Copy the byte to the next buffer location
-                buffer[i] = ch;
-            // Else no more bytes in the queue...
-            else
-                // Stop checking the queue
-                break;
-        }
-    }
+        // Copy up to byteCount bytes from the queue
+        i = queGetN(uart->rxQueue,buffer,byteCount);
     // Else if the UART does not have a RX queue and the Receive Complete Flag is set...
     else if(uart->usartRegs->RXDATAH & USART_RXCIF_bm)
     {
@@ -354,6 +573,83 @@ int uartReceiveChar(const UART_t *uart, char *character)
     return(uartReceive(uart, character, 1));
 }
 
+// Deliver the received bytes as frames, each ended by the receive line being
+// idle for bitTimes bit times (e.g. 35 for the Modbus RTU 3.5 character gap).
+// The idle timer runs on the system tick, so the gap is rounded up to whole
+// ticks plus one, e.g. 35 bit times on a 1 kHz tick is 5 ticks at 9600 baud
+// and 2 ticks at 115200 baud. Each complete frame triggers UART_EVENT_RX_FRAME on
+// uartGetEvent(uart). Read frames with uartRxFrame() and uartRxFrameRelease()
+// rather than uartReceive(). 0 turns framing off. Frames not yet read are
+// forgotten, but their bytes stay in the receive queue
+void uartRxFraming(const UART_t *uart, uint16_t bitTimes)
+{
+    volatile uartRx_t   *rx = uart->rx;
+    uint32_t            baud = uartGetBaud(uart);
+    uint32_t            gapTicks = 0;
+
+    if(rx == NULL)
+        return;
+    if(bitTimes && baud)
+    {
+        gapTicks = ((uint32_t)bitTimes*sysGetTickHz() + baud - 1)/baud + 1;
+        if(gapTicks > 0xffff)
+            gapTicks = 0xffff;
+    }
+
+    // Start critical section of code
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        tmrStop(rx->idle);
+        rx->gapTicks = gapTicks;
+        rx->current = 0;
+        rx->first = 0;
+        rx->count = 0;
+    } // End critical section
+}
+
+// Get the oldest complete receive frame in place, without copying it. data is
+// set to the frame's bytes in the receive queue and length, if not NULL, to
+// the bytes left in the frame. If the frame wraps around the end of the queue,
+// fewer than length bytes are contiguous. Release them with
+// uartRxFrameRelease() and call again for the rest
+// Return: The number of contiguous bytes at data, 0 if there's no frame
+uint16_t uartRxFrame(const UART_t *uart, void **data, uint16_t *length)
+{
+    volatile uartRx_t   *rx = uart->rx;
+    uint16_t            span = 0, frame = 0;
+
+    if(rx != NULL && rx->count)
+    {
+        frame = rx->frames[rx->first];
+        span = quePeek(uart->rxQueue,data);
+        if(span > frame)
+            span = frame;
+    }
+    if(length != NULL)
+        *length = frame;
+
+    return(span);
+}
+
+// Remove count bytes of the oldest complete frame from the receive queue. The
+// next frame is returned by uartRxFrame() once all of its bytes are released
+void uartRxFrameRelease(const UART_t *uart, uint16_t count)
+{
+    volatile uartRx_t   *rx = uart->rx;
+
+    if(rx == NULL || !rx->count)
+        return;
+    if(count > rx->frames[rx->first])
+        count = rx->frames[rx->first];
+
+    queRelease(uart->rxQueue,count);
+    if(!(rx->frames[rx->first] -= count))
+    {
+        rx->first = (rx->first + 1) % UART_RX_FRAMES;
+        --rx->count;
+    }
+}
+
 bool uartRxEmpty(const UART_t *uart)
 {
     return(queIsEmpty(uart->rxQueue));
@@ -364,18 +660,18 @@ bool uartRxFull(const UART_t *uart)
     return(queIsFull(uart->rxQueue));
 }
 
-uint8_t uartRxSize(const UART_t *uart)
+uint16_t uartRxSize(const UART_t *uart)
 {
     return(queGetSize(uart->rxQueue));
 }
 
-uint8_t uartRxCapacity(const UART_t *uart)
+uint16_t uartRxCapacity(const UART_t *uart)
 {
     return(queGetCapacity(uart->rxQueue));
 }
 
 //#ifdef QUE_STATS
-uint8_t uartRxMax(const UART_t *uart)
+uint16_t uartRxMax(const UART_t *uart)
 {
     return(queGetMaxSize(uart->rxQueue));
 }
@@ -391,23 +687,37 @@ bool uartTxFull(const UART_t *uart)
     return(queIsFull(uart->txQueue));
 }
 
-uint8_t uartTxSize(const UART_t *uart)
+uint16_t uartTxSize(const UART_t *uart)
 {
     return(queGetSize(uart->txQueue));
 }
 
-uint8_t uartTxCount(const UART_t *uart)
+uint16_t uartTxCapacity(const UART_t *uart)
 {
     return(queGetCapacity(uart->txQueue));
 }
 
 //#ifdef QUE_STATS
-uint8_t uartTxMax(const UART_t *uart)
+uint16_t uartTxMax(const UART_t *uart)
 {
     return(queGetMaxSize(uart->txQueue));
 }
 //#endif
 
+// Calculate the actual baud rate from the BAUD register and Rx mode
+// Return: The baud rate, or 0 if the CPU frequency is unknown
+uint32_t uartGetBaud(const UART_t *uart)
+{
+    uint32_t    freq = (uint32_t)cpuGetFrequency()*1000;
+    uint16_t    baudReg = uart->usartRegs->BAUD;
+    uint8_t     scale = (uart->usartRegs->CTRLB & USART_RXMODE_gm) == USART_RXMODE_CLK2X_gc ? 8 : 4;
+
+    if(!freq || !baudReg)
+        return(0);
+    // fBAUD = 64*fCLK/(S*BAUD)
+    return((scale*freq + baudReg/2)/baudReg);
+}
+
 char* uartName(const UART_t *uart)
 {
     return(uart->usartRegs==&USART0?"USART0":uart->usartRegs==&USART1?"USART1":uart->usartRegs==&USART2?"USART2":NULL);
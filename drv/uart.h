@@ -38,6 +38,38 @@ typedef struct
 	uint32_t	parityError;
 }UartStats_t;
 
+// Types of the UART event
+typedef enum
+{
+	UART_EVENT_TX_DONE = EVENT_TYPE_1,	///< The last byte of a uartWrite() buffer was loaded
+	UART_EVENT_RX_FRAME = EVENT_TYPE_2	///< The receive line went idle and ended a frame
+}uartEvents_t;
+
+// State of the asynchronous write (uartWrite) in progress
+typedef struct
+{
+	const uint8_t	*buffer;		///< Next byte of the caller's buffer to send
+	uint16_t		remaining;		///< Bytes of the buffer left to send, 0 when idle
+	uint16_t		queued;			///< Queued bytes to send before the buffer
+}uartTx_t;
+
+// Number of complete receive frames kept until read with uartRxFrame()
+#ifndef UART_RX_FRAMES
+#define UART_RX_FRAMES	4
+#endif
+
+// State of the idle line receive framing (uartRxFraming)
+typedef struct
+{
+	volatile timer_t	*idle;					///< Idle line timer, started by the first byte of a frame
+	uint32_t			lastTick;				///< System tick the last byte was received on
+	uint16_t			gapTicks;				///< Idle ticks that end a frame, 0 when framing is off
+	uint16_t			current;				///< Bytes received in the frame in progress
+	uint16_t			frames[UART_RX_FRAMES];	///< Bytes left in each complete frame, oldest first
+	uint8_t				first;					///< Index of the oldest complete frame
+	uint8_t				count;					///< Number of complete frames
+}uartRx_t;
+
 typedef struct
 {
 #ifdef UART_STATS
@@ -45,12 +77,15 @@ typedef struct
 #endif
 	const FILE*		 file;			///< Stream I/O file pointer for the buffered device
 	USART_t			 *usartRegs;	///< USART device
-	uint16_t		 baud;			///< Baud rate / 100
+	uint32_t		 baud;			///< Baud rate
 	USART_PMODE_t	 parity;		///< Parity
 	USART_CHSIZE_t	 dataBits;		///< Data bits
 	USART_SBMODE_t	 stopBits;		///< Stop bits
 	volatile queue_t *txQueue;		///< Transmit Queue
 	volatile queue_t *rxQueue;		///< Transmit Queue
+	volatile uartTx_t *tx;			///< Asynchronous write state
+	volatile uartRx_t *rx;			///< Receive framing state, NULL without a receive queue
+	volatile event_t *event;		///< Triggered with UART_EVENT_TX_DONE and UART_EVENT_RX_FRAME
 #ifdef UART_STATS
 	UartStats_t		*stats;			///< Device statistics
 #endif
@@ -76,18 +111,25 @@ typedef struct
  * or USART2) to use. The next parameters specify the baud rate, parity, data
  * bits, and stop bits. The most common settings for device uarts is
  * 115200,N,8,1. The last two parameters specify the size of the send and
- * receive queues. This macro will also create the queues. Lastly, the macro
+ * receive queues. This macro will also create the queues. The send queue is
+ * locked, since any code (including interrupt handlers) may print to the port.
+ * The receive queue is a single producer/single consumer queue filled only by
+ * the receive interrupt, so its size must be a power of 2. Lastly, the macro
  * adds a UART initialization function call to the global finite state machine
  * table. This initialization will be called during execution of sysInit().
 */
 #define ADD_UART_RW(usartName, usartReg, uartBaud, uartParity, uartDataBits, uartStopBits, txQueueSize, rxQueueSize) \
+				static volatile uartTx_t CONCAT(usartName,_tx); \
+				ADD_EVENT(usartName ## _evnt); \
 				ADD_QUEUE(usartName ## _TxQue,sizeof(uint8_t),txQueueSize); \
-				ADD_QUEUE(usartName ## _RxQue,sizeof(uint8_t),rxQueueSize); \
+				ADD_SPSC_QUEUE(usartName ## _RxQue,sizeof(uint8_t),rxQueueSize); \
+				ADD_TIMER(usartName ## _idle); \
+				static volatile uartRx_t CONCAT(usartName,_rx) = {.idle = &CONCAT(usartName,_idle)}; \
 				static UartStats_t CONCAT(usartName,_stats); \
 				const static UART_t SECTION(UART_TABLE) usartName; \
-				const static fioBuffers_t CONCAT(usartName,_buffers) = {.input = &CONCAT(usartName,_RxQue), .output = &CONCAT(usartName,_TxQue)}; \
+				const static fioBuffers_t CONCAT(usartName,_buffers) = {.input = &CONCAT(usartName,_RxQue), .output = &CONCAT(usartName,_TxQue), .start = uartStartOutput}; \
 				static FILE CONCAT(usartName,_file) = {.buf = (char *) &CONCAT(usartName,_buffers), .put = uartPutChar, .get = uartGetChar, .flags = _FDEV_SETUP_RW, .udata = (void *)&usartName }; \
-				const static UART_t SECTION(UART_TABLE) usartName = { .name = #usartName, .file = &CONCAT(usartName,_file), .usartRegs = &usartReg, .baud = (uartBaud/100), .parity = uartParity, .dataBits = uartDataBits, .stopBits = uartStopBits, .txQueue = &CONCAT(usartName,_TxQue), .rxQueue = &CONCAT(usartName,_RxQue), .stats = &CONCAT(usartName,_stats)}; \
+				const static UART_t SECTION(UART_TABLE) usartName = { .name = #usartName, .file = &CONCAT(usartName,_file), .usartRegs = &usartReg, .baud = uartBaud, .parity = uartParity, .dataBits = uartDataBits, .stopBits = uartStopBits, .txQueue = &CONCAT(usartName,_TxQue), .rxQueue = &CONCAT(usartName,_RxQue), .stats = &CONCAT(usartName,_stats), .tx = &CONCAT(usartName,_tx), .rx = &CONCAT(usartName,_rx), .event = &CONCAT(usartName,_evnt)}; \
 				ADD_INITIALIZER(usartName,uartInit,(void *)&usartName);
 /**----------------------------------------------------------------------------
  * Adds a Send only UART to the system
@@ -106,12 +148,14 @@ typedef struct
  * initialization will be called during execution of sysInit().
 */
 #define ADD_UART_WRITE(usartName, usartReg, uartBaud, uartParity, uartDataBits, uartStopBits, txQueueSize) \
+				static volatile uartTx_t CONCAT(usartName,_tx); \
+				ADD_EVENT(usartName ## _evnt); \
 				ADD_QUEUE(usartName ## _TxQue,sizeof(uint8_t),txQueueSize); \
 				static UartStats_t CONCAT(usartName,_stats); \
 				const static UART_t SECTION(UART_TABLE) usartName; \
-				const static fioBuffers_t CONCAT(usartName,_buffers) = {.input = NULL, .output = &CONCAT(usartName,_TxQue)}; \
+				const static fioBuffers_t CONCAT(usartName,_buffers) = {.input = NULL, .output = &CONCAT(usartName,_TxQue), .start = uartStartOutput}; \
 				static FILE CONCAT(usartName,_file) = {.buf = (char *) &CONCAT(usartName,_buffers), .put = uartPutChar, .get = uartGetChar, .flags = _FDEV_SETUP_WRITE, .udata = (void *)&usartName }; \
-				const static UART_t SECTION(UART_TABLE) usartName = { .name = #usartName, .file = &CONCAT(usartName,_file), .usartRegs = &usartReg, .baud = (uartBaud/100), .parity = uartParity, .dataBits = uartDataBits, .stopBits = uartStopBits, .txQueue = &CONCAT(usartName,_TxQue), .rxQueue = NULL, .stats = &CONCAT(usartName,_stats)}; \
+				const static UART_t SECTION(UART_TABLE) usartName = { .name = #usartName, .file = &CONCAT(usartName,_file), .usartRegs = &usartReg, .baud = uartBaud, .parity = uartParity, .dataBits = uartDataBits, .stopBits = uartStopBits, .txQueue = &CONCAT(usartName,_TxQue), .rxQueue = NULL, .stats = &CONCAT(usartName,_stats), .tx = &CONCAT(usartName,_tx), .event = &CONCAT(usartName,_evnt)}; \
 				ADD_INITIALIZER(usartName,uartInit,(void *)&usartName);
 /**----------------------------------------------------------------------------
  * Adds a receive only UART to the system
@@ -125,16 +169,21 @@ typedef struct
  * The next parameters specify the baud rate, parity, data bits, and stop bits.
  * The most common settings for device uarts is 115200,N,8,1. The last
  * parameter specifies the size of the receive queue. This macro will also 
- * create the queue. Lastly, the macro adds a UART initialization function call
+ * create the queue (SPSC, filled only by the receive interrupt, so the size
+ * must be a power of 2). Lastly, the macro adds a UART initialization function call
  * to the global finite state machine table. This initialization will be called
  * during execution of sysInit().
 */
 #define ADD_UART_READ(usartName, usartReg, uartBaud, uartParity, uartDataBits, uartStopBits, rxQueueSize) \
-				ADD_QUEUE(usartName ## _RxQue,sizeof(uint8_t),rxQueueSize); \
+				static volatile uartTx_t CONCAT(usartName,_tx); \
+				ADD_EVENT(usartName ## _evnt); \
+				ADD_SPSC_QUEUE(usartName ## _RxQue,sizeof(uint8_t),rxQueueSize); \
+				ADD_TIMER(usartName ## _idle); \
+				static volatile uartRx_t CONCAT(usartName,_rx) = {.idle = &CONCAT(usartName,_idle)}; \
 				static UartStats_t CONCAT(usartName,_stats); \
 				const static UART_t SECTION(UART_TABLE) usartName; \
 				static FILE CONCAT(usartName,_file) = { .put = uartPutChar, .get = uartGetChar, .flags = _FDEV_SETUP_READ, .udata = (void *)&usartName }; \
-				const static UART_t SECTION(UART_TABLE) usartName = { .name = #usartName, .file = &CONCAT(usartName,_file), .usartRegs = &usartReg, .baud = (uartBaud/100), .parity = uartParity, .dataBits = uartDataBits, .stopBits = uartStopBits, .txQueue = NULL, .rxQueue = &CONCAT(usartName,_RxQue), .stats = &CONCAT(usartName,_stats)}; \
+				const static UART_t SECTION(UART_TABLE) usartName = { .name = #usartName, .file = &CONCAT(usartName,_file), .usartRegs = &usartReg, .baud = uartBaud, .parity = uartParity, .dataBits = uartDataBits, .stopBits = uartStopBits, .txQueue = NULL, .rxQueue = &CONCAT(usartName,_RxQue), .stats = &CONCAT(usartName,_stats), .tx = &CONCAT(usartName,_tx), .rx = &CONCAT(usartName,_rx), .event = &CONCAT(usartName,_evnt)}; \
 				ADD_INITIALIZER(usartName,uartInit,(void *)&usartName);
 /**----------------------------------------------------------------------------
  * Adds a raw UART to the system
@@ -151,54 +200,85 @@ typedef struct
  * will be called during execution of sysInit().
 */
 #define ADD_UART_RAW(usartName, usartReg, uartBaud, uartParity, uartDataBits, uartStopBits) \
+				static volatile uartTx_t CONCAT(usartName,_tx); \
+				ADD_EVENT(usartName ## _evnt); \
 				static UartStats_t CONCAT(usartName,_stats); \
-				const static UART_t SECTION(UART_TABLE) usartName = { .name = #usartName, .file = &CONCAT(usartName,_file), .usartRegs = &usartReg, .baud = (uartBaud/100), .parity = uartParity, .dataBits = uartDataBits, .stopBits = uartStopBits, .txQueue = NULL, .rxQueue = NULL, .stats = &CONCAT(usartName,_stats)}; \
+				const static UART_t SECTION(UART_TABLE) usartName = { .name = #usartName, .file = NULL, .usartRegs = &usartReg, .baud = uartBaud, .parity = uartParity, .dataBits = uartDataBits, .stopBits = uartStopBits, .txQueue = NULL, .rxQueue = NULL, .stats = &CONCAT(usartName,_stats), .tx = &CONCAT(usartName,_tx), .event = &CONCAT(usartName,_evnt)}; \
 				ADD_INITIALIZER(usartName,uartInit,(void *)&usartName);
 #else
 #define ADD_UART_RW(usartName, usartReg, uartBaud, uartParity, uartDataBits, uartStopBits, txQueueSize, rxQueueSize) \
+				static volatile uartTx_t CONCAT(usartName,_tx); \
+				ADD_EVENT(usartName ## _evnt); \
 				ADD_QUEUE(usartName ## _TxQue,sizeof(uint8_t),txQueueSize); \
-				ADD_QUEUE(usartName ## _RxQue,sizeof(uint8_t),rxQueueSize); \
+				ADD_SPSC_QUEUE(usartName ## _RxQue,sizeof(uint8_t),rxQueueSize); \
+				ADD_TIMER(usartName ## _idle); \
+				static volatile uartRx_t CONCAT(usartName,_rx) = {.idle = &CONCAT(usartName,_idle)}; \
 				const static UART_t SECTION(UART_TABLE) usartName; \
-				const static fioBuffers_t CONCAT(usartName,_buffers) = {.input = &CONCAT(usartName,_RxQue), .output = &CONCAT(usartName,_TxQue)}; \
+				const static fioBuffers_t CONCAT(usartName,_buffers) = {.input = &CONCAT(usartName,_RxQue), .output = &CONCAT(usartName,_TxQue), .start = uartStartOutput}; \
 				static FILE CONCAT(usartName,_file) = {.buf = (char *) &CONCAT(usartName,_buffers), .put = uartPutChar, .get = uartGetChar, .flags = _FDEV_SETUP_RW, .udata = (void *)&usartName }; \
-				const static UART_t SECTION(UART_TABLE) usartName = { file = &CONCAT(usartName,_file), .usartRegs = &usartReg, .baud = (uartBaud/100), .parity = uartParity, .dataBits = uartDataBits, .stopBits = uartStopBits, .txQueue = &CONCAT(usartName,_TxQue), .rxQueue = &CONCAT(usartName,_RxQue)}; \
+				const static UART_t SECTION(UART_TABLE) usartName = { .file = &CONCAT(usartName,_file), .usartRegs = &usartReg, .baud = uartBaud, .parity = uartParity, .dataBits = uartDataBits, .stopBits = uartStopBits, .txQueue = &CONCAT(usartName,_TxQue), .rxQueue = &CONCAT(usartName,_RxQue), .tx = &CONCAT(usartName,_tx), .rx = &CONCAT(usartName,_rx), .event = &CONCAT(usartName,_evnt)}; \
 				ADD_INITIALIZER(usartName,uartInit,(void *)&usartName);
 #define ADD_UART_WRITE(usartName, usartReg, uartBaud, uartParity, uartDataBits, uartStopBits, txQueueSize) \
+				static volatile uartTx_t CONCAT(usartName,_tx); \
+				ADD_EVENT(usartName ## _evnt); \
 				ADD_QUEUE(usartName ## _TxQue,sizeof(uint8_t),txQueueSize); \
 				const static UART_t SECTION(UART_TABLE) usartName; \
-				const static fioBuffers_t CONCAT(usartName,_buffers) = {.input = NULL, .output = &CONCAT(usartName,_TxQue)}; \
+				const static fioBuffers_t CONCAT(usartName,_buffers) = {.input = NULL, .output = &CONCAT(usartName,_TxQue), .start = uartStartOutput}; \
 				static FILE CONCAT(usartName,_file) = {.buf = (char *) &CONCAT(usartName,_buffers), .put = uartPutChar, .get = uartGetChar, .flags = _FDEV_SETUP_WRITE, .udata = (void *)&usartName }; \
-				const static UART_t SECTION(UART_TABLE) usartName = { .file = &CONCAT(usartName,_file), .usartRegs = &usartReg, .baud = (uartBaud/100), .parity = uartParity, .dataBits = uartDataBits, .stopBits = uartStopBits, .txQueue = &CONCAT(usartName,_TxQue), .rxQueue = NULL}; \
+				const static UART_t SECTION(UART_TABLE) usartName = { .file = &CONCAT(usartName,_file), .usartRegs = &usartReg, .baud = uartBaud, .parity = uartParity, .dataBits = uartDataBits, .stopBits = uartStopBits, .txQueue = &CONCAT(usartName,_TxQue), .rxQueue = NULL, .tx = &CONCAT(usartName,_tx), .event = &CONCAT(usartName,_evnt)}; \
 				ADD_INITIALIZER(usartName,uartInit,(void *)&usartName);
 #define ADD_UART_READ(usartName, usartReg, uartBaud, uartParity, uartDataBits, uartStopBits, rxQueueSize) \
-				ADD_QUEUE(usartName ## _RxQue,sizeof(uint8_t),rxQueueSize); \
+				static volatile uartTx_t CONCAT(usartName,_tx); \
+				ADD_EVENT(usartName ## _evnt); \
+				ADD_SPSC_QUEUE(usartName ## _RxQue,sizeof(uint8_t),rxQueueSize); \
+				ADD_TIMER(usartName ## _idle); \
+				static volatile uartRx_t CONCAT(usartName,_rx) = {.idle = &CONCAT(usartName,_idle)}; \
 				const static UART_t SECTION(UART_TABLE) usartName; \
 				static FILE CONCAT(usartName,_file) = { .put = uartPutChar, .get = uartGetChar, .flags = _FDEV_SETUP_READ, .udata = (void *)&usartName }; \
-				const static UART_t SECTION(UART_TABLE) usartName = { .file = &CONCAT(usartName,_file), .usartRegs = &usartReg, .baud = (uartBaud/100), .parity = uartParity, .dataBits = uartDataBits, .stopBits = uartStopBits, .txQueue = NULL, .rxQueue = &CONCAT(usartName,_RxQue)}; \
+				const static UART_t SECTION(UART_TABLE) usartName = { .file = &CONCAT(usartName,_file), .usartRegs = &usartReg, .baud = uartBaud, .parity = uartParity, .dataBits = uartDataBits, .stopBits = uartStopBits, .txQueue = NULL, .rxQueue = &CONCAT(usartName,_RxQue), .tx = &CONCAT(usartName,_tx), .rx = &CONCAT(usartName,_rx), .event = &CONCAT(usartName,_evnt)}; \
 				ADD_INITIALIZER(usartName,uartInit,(void *)&usartName);
 #define ADD_UART_RAW(usartName, usartReg, uartBaud, uartParity, uartDataBits, uartStopBits) \
-				const static UART_t SECTION(UART_TABLE) usartName = { .file = &CONCAT(usartName,_file), .usartRegs = &usartReg, .baud = (uartBaud/100), .parity = uartParity, .dataBits = uartDataBits, .stopBits = uartStopBits, .txQueue = NULL, .rxQueue = NULL}; \
+				static volatile uartTx_t CONCAT(usartName,_tx); \
+				ADD_EVENT(usartName ## _evnt); \
+				const static UART_t SECTION(UART_TABLE) usartName = { .file = NULL, .usartRegs = &usartReg, .baud = uartBaud, .parity = uartParity, .dataBits = uartDataBits, .stopBits = uartStopBits, .txQueue = NULL, .rxQueue = NULL, .tx = &CONCAT(usartName,_tx), .event = &CONCAT(usartName,_evnt)}; \
 				ADD_INITIALIZER(usartName,uartInit,(void *)&usartName);
 #endif
 
 // External Functions ---------------------------------------------------------
+static inline volatile event_t *uartGetEvent(const UART_t *uart)
+{
+	return(uart->event);
+}
+
+static inline bool uartWriteBusy(const UART_t *uart)
+{
+	return(uart->tx->remaining != 0);
+}
+
 extern int uartPutChar(char c, FILE *stream);
 extern int uartGetChar(FILE *stream);
+extern void uartStartOutput(FILE *stream, uint16_t dropped);
 extern int uartTransmit(const UART_t *uart, char *buffer, size_t byteCount);
 extern int uartTransmitStr(const UART_t *uart, char *str);
 extern int uartTransmitChar(const UART_t *uart, char ch);
+extern bool uartWrite(const UART_t *uart, const void *buffer, uint16_t length);
+extern void uartWaitTxSpace(const UART_t *uart, uint16_t count);
 extern int uartReceive(const UART_t *uart, char *buffer, size_t byteCount);
 extern int uartReceiveChar(const UART_t *uart, char *character);
+extern void uartRxFraming(const UART_t *uart, uint16_t bitTimes);
+extern uint16_t uartRxFrame(const UART_t *uart, void **data, uint16_t *length);
+extern void uartRxFrameRelease(const UART_t *uart, uint16_t count);
 extern bool uartRxEmpty(const UART_t *uart);
 extern bool uartRxFull(const UART_t *uart);
-extern uint8_t uartRxSize(const UART_t *uart);
-extern uint8_t uartRxCount(const UART_t *uart);
-extern uint8_t uartRxMax(const UART_t *uart);
+extern uint16_t uartRxSize(const UART_t *uart);
+extern uint16_t uartRxCapacity(const UART_t *uart);
+extern uint16_t uartRxMax(const UART_t *uart);
 extern bool uartTxEmpty(const UART_t *uart);
 extern bool uartTxFull(const UART_t *uart);
-extern uint8_t uartTxSize(const UART_t *uart);
-extern uint8_t uartTxCount(const UART_t *uart);
-extern uint8_t uartTxMax(const UART_t *uart);
+extern uint16_t uartTxSize(const UART_t *uart);
+extern uint16_t uartTxCapacity(const UART_t *uart);
+extern uint16_t uartTxMax(const UART_t *uart);
 extern char* uartName(const UART_t *uart);
+extern uint32_t uartGetBaud(const UART_t *uart);
 
 #endif /* UART_H_ */
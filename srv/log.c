@@ -20,6 +20,109 @@
  // Includes -------------------------------------------------------------------
  #include "../avrOS.h"
 
+// Externs --------------------------------------------------------------------
+extern void *__start_FSM_TABLE,*__stop_FSM_TABLE;
+extern void *__start_LOG_TABLE,*__stop_LOG_TABLE;
+
+// Globals --------------------------------------------------------------------
+uint8_t		logInitLevel = LOG_LEVEL;		// Runtime log level outside of the state machines
+
+#ifdef LOG_RATE_LIMIT
+static const logSiteDescr_t	*logLast = NULL;	// Call site of the last message logged
+static uint16_t				logLastTick;		// Low 16 bits of the tick it was logged on
+static uint16_t				logRepeats = 0;		// Repeats of it not logged yet
+static uint32_t				logRateLimited = 0;	// Messages dropped by the call site token buckets
+static uint32_t				logCoalesced = 0;	// Messages counted as repeats
+
+static void logRepeatFlush(volatile timer_t *timer);
+
+// Expires when the repeats of the last message can no longer be coalesced
+ADD_TIMER(logRepeatTimer);
+#endif
+
+#if LOG_FORMAT == 5 && LOG_LEVEL > 0
+// Constants ------------------------------------------------------------------
+#define LOG_LINE_SIZE	96		// Longest record line, 8 long arguments
+
+// Internal Function Prototypes -----------------------------------------------
+static int logDeferredSend(volatile fsmStateMachine_t *stateMachine);
+
+// Deferred log records, sent to the log by a lowest priority state machine
+ADD_MSG_QUEUE(logRecords,LOG_RECORD_QUEUE_SIZE);
+ADD_STATE_MACHINE(logDeferred_sm,logDeferredInit,FSM_APP | 0x3f);
+#endif
+
+// Command Line Interface -----------------------------------------------------
+#ifdef LOG_CLI
+ADD_COMMAND("log",logCmd,true);
+
+static const char *logLevelNames[] = {"none","crit","err","warn","info"};
+
+// Display the runtime log levels, or set the level of a state machine, "init"
+// for the initializers, or "all":
+//   log [<state machine>|init|all <level>]
+// The level is a number from 0 to LOG_LEVEL or none, crit, err, warn or info.
+// "log limits" lists the call sites that were rate limited or coalesced
+int logCmd(int argc, char *argv[])
+{
+	fsmStateMachineDescr_t	*descr = (fsmStateMachineDescr_t *)&__start_FSM_TABLE;
+	int						ret = 0;
+	uint8_t					level;
+
+	if(argc == 1)
+	{
+		printf(BOLD UNDERLINE FG_BLUE "%-20s%s\n\r" RESET,"State Machine","Level");
+		printf("%-20s%s\n\r","init",logLevelNames[logInitLevel]);
+		for(; descr < (fsmStateMachineDescr_t *)&__stop_FSM_TABLE; ++descr)
+			if(descr->stateMachine != NULL)
+				printf("%-20s%s\n\r",descr->name,logLevelNames[descr->stateMachine->logLevel]);
+	}
+	else if(argc == 3)
+	{
+		// Find the level by name or number
+		for(level=0; level<sizeof(logLevelNames)/sizeof(logLevelNames[0]); ++level)
+			if(!strcmp(argv[2],logLevelNames[level]) || (argv[2][0] == '0'+level && argv[2][1] == '\0'))
+				break;
+		if(level >= sizeof(logLevelNames)/sizeof(logLevelNames[0]))
+			ret = -1;
+		else
+		{
+			bool all = !strcmp(argv[1],"all");
+
+			ret = -1;
+			if(all || !strcmp(argv[1],"init"))
+			{
+				logSetLevel(NULL,level);
+				ret = 0;
+			}
+			for(; descr < (fsmStateMachineDescr_t *)&__stop_FSM_TABLE; ++descr)
+				if(descr->stateMachine != NULL && (all || !strcmp(argv[1],descr->name)))
+				{
+					logSetLevel(descr->stateMachine,level);
+					ret = 0;
+				}
+		}
+	}
+#ifdef LOG_RATE_LIMIT
+	// List the call sites that have suppressed messages
+	else if(argc == 2 && !strcmp(argv[1],"limits"))
+	{
+		logSiteDescr_t	*site = (logSiteDescr_t *)&__start_LOG_TABLE;
+
+		printf(BOLD UNDERLINE FG_BLUE "%-10s%-8s%s\n\r" RESET,"Suppressed","Tokens","Message");
+		for(; site < (logSiteDescr_t *)&__stop_LOG_TABLE; ++site)
+			if(site->state->suppressed)
+				printf("%10u%8u%s\n\r",site->state->suppressed,site->state->tokens,site->fmt);
+		printf("Rate limited:%10lu Coalesced:%10lu Pending repeats:%6u\n\r",logRateLimited,logCoalesced,logRepeats);
+	}
+#endif
+	else
+		ret = -1;
+
+	return(ret);
+}
+#endif // LOG_CLI
+
 // Internal Functions ----------------------------------------------------------
 int logInit(const fsmStateMachineDescr_t *stateMachineDescr)
 {
@@ -28,6 +131,9 @@ int logInit(const fsmStateMachineDescr_t *stateMachineDescr)
 	
 	// Setup stderr so stdout.h functions like fprintf output the log
 	stderr = outFile;
+#ifdef LOG_RATE_LIMIT
+	tmrSetCallback(&logRepeatTimer,logRepeatFlush);
+#endif
 
 	// Hide the cursor
 	fprintf(stderr,CURSOR_HIDE);
@@ -38,6 +144,108 @@ int logInit(const fsmStateMachineDescr_t *stateMachineDescr)
 }
 
 // External Function ----------------------------------------------------------
+// Set the runtime log level of a state machine, or of the code outside of the
+// state machines if stateMachine is NULL. Limited to the LOG_LEVEL ceiling
+void logSetLevel(volatile fsmStateMachine_t *stateMachine, logLevel_t level)
+{
+	if(level > LOG_LEVEL)
+		level = LOG_LEVEL;
+
+	if(stateMachine != NULL)
+		stateMachine->logLevel = level;
+	else
+		logInitLevel = level;
+}
+
+#ifdef LOG_RATE_LIMIT
+// Log the number of times the last message was repeated, at its level
+static void logRepeated(uint8_t level, uint16_t repeats)
+{
+	if(level == LOG_LEVEL_ERR)
+		LOG_ERROR("Last message repeated %u times",repeats);
+	else if(level == LOG_LEVEL_WARN)
+		LOG_WARN("Last message repeated %u times",repeats);
+	else
+		LOG_INFO("Last message repeated %u times",repeats);
+}
+
+// Log the repeats of the last message once the LOG_REPEAT_TICKS window has
+// passed, so the count of a flood that stops is still reported
+static void logRepeatFlush(volatile timer_t *timer)
+{
+	const logSiteDescr_t	*last;
+	uint16_t				repeats;
+
+	UNUSED(timer);
+
+	// Start critical section of code
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		last = logLast;
+		repeats = logRepeats;
+		logRepeats = 0;
+	} // End critical section
+
+	if(repeats)
+		logRepeated(last->level,repeats);
+}
+
+// Decide if a call site's message is logged. Repeats of the last message
+// logged within LOG_REPEAT_TICKS are counted and reported with the next
+// message logged, or when the window ends. Otherwise the call site's token bucket, refilled one token
+// every LOG_RATE_TICKS up to LOG_BURST, limits its rate
+// Return: True if the message is to be logged
+bool logAllow(const logSiteDescr_t *site)
+{
+	volatile logSite_t		*state = site->state;
+	const logSiteDescr_t	*last = NULL;
+	uint16_t				now = (uint16_t)sysGetTickCount(), tokens, repeats = 0;
+	bool					ret = false;
+
+	// Start critical section of code
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		// Refill the bucket
+		tokens = (uint16_t)(now - state->tick)/LOG_RATE_TICKS;
+		if(tokens)
+		{
+			state->tick += tokens*LOG_RATE_TICKS;
+			tokens += state->tokens;
+			state->tokens = tokens > LOG_BURST ? LOG_BURST : tokens;
+		}
+
+		if(site == logLast && (uint16_t)(now - logLastTick) < LOG_REPEAT_TICKS)
+		{
+			// On the first repeat, flush the count when the window ends
+			if(++logRepeats == 1)
+				tmrStart(&logRepeatTimer,LOG_REPEAT_TICKS - (uint16_t)(now - logLastTick),0);
+			++logCoalesced;
+			++state->suppressed;
+		}
+		else if(!state->tokens)
+		{
+			++logRateLimited;
+			++state->suppressed;
+		}
+		else
+		{
+			--state->tokens;
+			last = logLast;
+			repeats = logRepeats;
+			logLast = site;
+			logLastTick = now;
+			logRepeats = 0;
+			ret = true;
+		}
+	} // End critical section
+
+	if(repeats)
+		logRepeated(last->level,repeats);
+
+	return(ret);
+}
+#endif
+
 void logRam()
 {
 	if(stderr!=NULL)
@@ -61,3 +269,103 @@ void logNewLine()
 		fprintf(stderr,"\n\r");
 	}
 }
+
+#if LOG_FORMAT == 5 && LOG_LEVEL > 0
+// Fill in the header of a deferred log record and queue it. If the record
+// queue is full the record is dropped and counted in its message stats
+void logDefer(const char *fmt, logLevel_t level, uint8_t *record, uint8_t length)
+{
+	logRecord_t					*header = (logRecord_t *)record;
+	volatile fsmStateMachine_t	*stateMachine = fsmGetCurrentStateMachine();
+
+	header->id = (uint16_t)(uintptr_t)fmt;
+	header->tick = sysGetTickCount();
+	header->level = level;
+	header->fsm = stateMachine != NULL ? stateMachine->stateMachineDescr - (const fsmStateMachineDescr_t *)&__start_FSM_TABLE : LOG_NO_FSM;
+	msgSend(&logRecords,record,length);
+}
+
+// Send a deferred record to the log as a line read by util/log2txt:
+//   L <id> <tick> <level> <fsm> <argument bytes>
+static void logSendRecord(const uint8_t *record, uint16_t length)
+{
+	const logRecord_t	*header = (const logRecord_t *)record;
+	uint16_t			i;
+
+	fprintf(stderr,"\n\rL %04x %08lx %x %02x ",header->id,header->tick,header->level,header->fsm);
+	for(i=sizeof(logRecord_t);i<length;++i)
+		fprintf(stderr,"%02x",record[i]);
+}
+
+// Send the queued deferred records now. Used by CRITICAL(), which stops the
+// system before the logger state machine would run again
+void logFlush()
+{
+	void		*record;
+	uint16_t	length;
+
+	while(stderr != NULL && msgPeek(&logRecords,&record,&length))
+	{
+		logSendRecord(record,length);
+		msgRelease(&logRecords);
+		fioBusyWaitOutput(stderr);
+	}
+}
+
+// State Machine Functions ----------------------------------------------------
+// Name the state machines for util/log2txt, by their index in the FSM_TABLE:
+//   N <fsm> <name>
+int logDeferredInit(volatile fsmStateMachine_t *stateMachine)
+{
+	fsmStateMachineDescr_t	*descr = (fsmStateMachineDescr_t *)&__start_FSM_TABLE;
+	uint8_t					i;
+
+	if(stderr != NULL)
+	{
+		for(i=0; descr < (fsmStateMachineDescr_t *)&__stop_FSM_TABLE; ++descr, ++i)
+		{
+			fprintf(stderr,"\n\rN %02x %s",i,descr->name);
+			fioBusyWaitOutput(stderr);
+		}
+	}
+	fsmSetNextState(stateMachine,logDeferredSend);
+
+	return(0);
+}
+
+// Send one record per call while the log output has room for it. Without a
+// log file the records are dropped
+static int logDeferredSend(volatile fsmStateMachine_t *stateMachine)
+{
+	fioBuffers_t		*buffers = stderr != NULL ? (fioBuffers_t *)stderr->buf : NULL;
+	volatile queue_t	*output = buffers != NULL ? buffers->output : NULL;
+	void				*record;
+	uint16_t			length;
+
+	// If the record might not fit in the log output queue, wait for room
+	if(output != NULL && queGetCapacity(output) - queGetSize(output) < LOG_LINE_SIZE)
+		fioWaitOutputSpace(stderr,LOG_LINE_SIZE);
+	// Else if there's a record, send it
+	else if(msgPeek(&logRecords,&record,&length))
+	{
+		if(stderr != NULL)
+			logSendRecord(record,length);
+		msgRelease(&logRecords);
+	}
+	// Else wait for a record
+	else
+	{
+		// Start critical section of code
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+		{
+			if(!msgGetCount(&logRecords))
+			{
+				evntEnable(queGetEvent(&logRecords),QUE_EVENT_NOT_EMPTY,fsmReady,stateMachine);
+				fsmWait(stateMachine);
+			}
+		} // End critical section
+	}
+
+	return(0);
+}
+#endif // LOG_FORMAT LOG_LEVEL
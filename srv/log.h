@@ -27,6 +27,44 @@ typedef struct
 	FILE *outFile;
 } logInstance_t;
 
+// Log levels, the same numbering as LOG_LEVEL
+typedef enum
+{
+	LOG_LEVEL_CRIT = 1,
+	LOG_LEVEL_ERR,
+	LOG_LEVEL_WARN,
+	LOG_LEVEL_INFO
+} logLevel_t;
+
+// Header of a deferred log record (LOG_FORMAT 5). The arguments follow it
+// packed as avr-gcc passes them to printf: char and short as int, pointers as
+// 16 bits. util/log2txt decodes the records, so keep the two in step
+typedef struct
+{
+	uint16_t	id;			// Flash address of the format string
+	uint32_t	tick;		// System tick count
+	uint8_t		level;		// logLevel_t
+	uint8_t		fsm;		// FSM_TABLE index of the current state machine or LOG_NO_FSM
+} __attribute__((packed)) logRecord_t;
+
+#define LOG_NO_FSM		0xff	// The log call wasn't made from a state machine
+
+// Rate limit state of a log call site (LOG_RATE_LIMIT)
+typedef struct
+{
+	uint8_t		tokens;			// Messages the call site can log now, up to LOG_BURST
+	uint16_t	tick;			// Low 16 bits of the tick the next token is counted from
+	uint16_t	suppressed;		// Messages rate limited or coalesced
+} logSite_t;
+
+// Row in the LOG_TABLE, one per log call site
+typedef struct
+{
+	const char			*fmt;		// Format string of the message
+	volatile logSite_t	*state;
+	uint8_t				level;		// logLevel_t
+} logSiteDescr_t;
+
 // Add a log instance macro
 #define ADD_LOG(logName, logFile) \
 				static FILE logFile; \
@@ -35,76 +73,116 @@ typedef struct
 
 // LOG message macros ---------------------------------------------------------
 #if LOG_FORMAT == 1
-#define INFO(fmt_str,...)	do{\
+#define LOG_INFO(fmt_str,...)	do{\
 	fprintf(stderr,FG_GREEN BOLD "\n\r%s: " RESET,"INFO"); \
 	fprintf(stderr,fmt_str, ##__VA_ARGS__); \
 }while(0)
-#define WARN(fmt_str,...)	do{\
+#define LOG_WARN(fmt_str,...)	do{\
 	fprintf(stderr,FG_ORANGE BOLD "\n\r%s: " RESET,"WARN"); \
 	fprintf(stderr,fmt_str, ##__VA_ARGS__); \
 }while(0)
-#define ERROR(fmt_str,...)	do{\
+#define LOG_ERROR(fmt_str,...)	do{\
 	fprintf(stderr,FG_RED BOLD "\n\r%s: " RESET,"ERR "); \
 	fprintf(stderr,fmt_str, ##__VA_ARGS__); \
 }while(0)
-#define CRITICAL(fmt_str,...)	do{\
+#define LOG_CRITICAL(fmt_str,...)	do{\
 	fprintf(stderr,FG_WHITE BG_RED BOLD "\n\r%s: " RESET,sysGetTickCount(),"CRIT"); \
 	fprintf(stderr,fmt_str, ##__VA_ARGS__); \
 	fprintf(stderr,FG_WHITE BG_RED BOLD BLINKING "\n\r+++ System Stopped +++" RESET); \
 	while(1);\
 }while(0)
 #elif LOG_FORMAT == 2
-#define INFO(fmt_str,...)	do{\
+#define LOG_INFO(fmt_str,...)	do{\
 	fprintf(stderr,"\n\r%lu:%s: ",sysGetTickCount(),"INFO"); \
 	fprintf(stderr,fmt_str, ##__VA_ARGS__); \
 }while(0)
-#define WARN(fmt_str,...)	do{\
+#define LOG_WARN(fmt_str,...)	do{\
 	fprintf(stderr,"\n\r%lu:%s: ",sysGetTickCount(),"WARN"); \
 	fprintf(stderr,fmt_str, ##__VA_ARGS__); \
 }while(0)
-#define ERROR(fmt_str,...)	do{\
+#define LOG_ERROR(fmt_str,...)	do{\
 	fprintf(stderr,"\n\r%lu:%s: ",sysGetTickCount(),"ERR "); \
 	fprintf(stderr,fmt_str, ##__VA_ARGS__); \
 }while(0)
-#define CRITICAL(fmt_str,...)	do{\
+#define LOG_CRITICAL(fmt_str,...)	do{\
 	fprintf(stderr,"\n\r%lu:%s: ",sysGetTickCount(),"CRIT"); \
 	fprintf(stderr,fmt_str, ##__VA_ARGS__); \
 	fprintf(stderr,"\n\r+++ System Stopped +++"); \
 	while(1);\
 }while(0)
 #elif LOG_FORMAT == 3
-#define INFO(fmt_str,...)	do{\
+#define LOG_INFO(fmt_str,...)	do{\
 	fprintf(stderr,FG_GREEN BOLD "\n\r%lu:%s:%s:%s: " RESET,sysGetTickCount(),"INFO",fsmGetCurrentStateMachineName(),fsmGetCurrentStateName(fsmGetCurrentStateMachine())); \
 	fprintf(stderr,fmt_str, ##__VA_ARGS__); \
 }while(0)
-#define WARN(fmt_str,...)	do{\
+#define LOG_WARN(fmt_str,...)	do{\
 	fprintf(stderr,FG_ORANGE BOLD "\n\r%lu:%s:%s:%s: " RESET,sysGetTickCount(),"WARN",fsmGetCurrentStateMachineName(),fsmGetCurrentStateName(fsmGetCurrentStateMachine())); \
 	fprintf(stderr,fmt_str, ##__VA_ARGS__); \
 }while(0)
-#define ERROR(fmt_str,...)	do{\
+#define LOG_ERROR(fmt_str,...)	do{\
 	fprintf(stderr,FG_RED BOLD "\n\r%lu:%s:%s:%s: " RESET,sysGetTickCount(),"ERR ",fsmGetCurrentStateMachineName(),fsmGetCurrentStateName(fsmGetCurrentStateMachine())); \
 	fprintf(stderr,fmt_str, ##__VA_ARGS__); \
 }while(0)
-#define CRITICAL(fmt_str,...)	do{\
+#define LOG_CRITICAL(fmt_str,...)	do{\
 	fprintf(stderr,FG_WHITE BG_RED BOLD "\n\r%lu:%s:%s:%s: " RESET,sysGetTickCount(),"CRIT",fsmGetCurrentStateMachineName(),fsmGetCurrentStateName(fsmGetCurrentStateMachine())); \
 	fprintf(stderr,fmt_str, ##__VA_ARGS__); \
 	fprintf(stderr,FG_WHITE BG_RED BOLD BLINKING "\n\r+++ System Stopped +++" RESET); \
 	while(1);\
 }while(0)
+#elif LOG_FORMAT == 5
+// Deferred log. Each call only packs a record into the log record queue. The
+// logger state machine sends the records to the log later, for util/log2txt
+// to format on the host. Up to 8 arguments
+#define LOG_INFO(fmt_str,...)		LOG_DEFER(LOG_LEVEL_INFO,fmt_str, ##__VA_ARGS__)
+#define LOG_WARN(fmt_str,...)		LOG_DEFER(LOG_LEVEL_WARN,fmt_str, ##__VA_ARGS__)
+#define LOG_ERROR(fmt_str,...)		LOG_DEFER(LOG_LEVEL_ERR,fmt_str, ##__VA_ARGS__)
+#define LOG_CRITICAL(fmt_str,...)	do{\
+	LOG_DEFER(LOG_LEVEL_CRIT,fmt_str, ##__VA_ARGS__); \
+	logFlush(); \
+	fprintf(stderr,"\n\r+++ System Stopped +++"); \
+	while(1);\
+}while(0)
+
+// The format string stays in flash and its address identifies the message
+#define LOG_DEFER(logLevel,fmt_str,...)	do{\
+	static const char logFmt[] PROGMEM = fmt_str; \
+	uint8_t logRecord[sizeof(logRecord_t) LOG_EACH(LOG_ARG_SIZE, ##__VA_ARGS__)], *logArgs = &logRecord[sizeof(logRecord_t)]; \
+	LOG_EACH(LOG_ARG_PACK, ##__VA_ARGS__) \
+	(void)logArgs; \
+	logDefer(logFmt,logLevel,logRecord,sizeof(logRecord)); \
+}while(0)
+
+// Adding 0 promotes the argument like a variable argument is promoted
+#define LOG_ARG_SIZE(arg)		+ sizeof((arg)+0)
+#define LOG_ARG_PACK(arg)		{ __typeof__((arg)+0) logArg = (arg); memcpy(logArgs,&logArg,sizeof(logArg)); logArgs += sizeof(logArg); }
+
+// Apply op to each of up to 8 arguments
+#define LOG_NARGS(...)						LOG_NARGS_(0, ##__VA_ARGS__,8,7,6,5,4,3,2,1,0)
+#define LOG_NARGS_(z,a,b,c,d,e,f,g,h,n,...)	n
+#define LOG_EACH(op,...)					CONCAT(LOG_EACH_,LOG_NARGS(__VA_ARGS__))(op, ##__VA_ARGS__)
+#define LOG_EACH_0(op)
+#define LOG_EACH_1(op,a)					op(a)
+#define LOG_EACH_2(op,a,...)				op(a) LOG_EACH_1(op,__VA_ARGS__)
+#define LOG_EACH_3(op,a,...)				op(a) LOG_EACH_2(op,__VA_ARGS__)
+#define LOG_EACH_4(op,a,...)				op(a) LOG_EACH_3(op,__VA_ARGS__)
+#define LOG_EACH_5(op,a,...)				op(a) LOG_EACH_4(op,__VA_ARGS__)
+#define LOG_EACH_6(op,a,...)				op(a) LOG_EACH_5(op,__VA_ARGS__)
+#define LOG_EACH_7(op,a,...)				op(a) LOG_EACH_6(op,__VA_ARGS__)
+#define LOG_EACH_8(op,a,...)				op(a) LOG_EACH_7(op,__VA_ARGS__)
 #elif LOG_FORMAT == 4
-#define INFO(fmt_str,...)	do{\
+#define LOG_INFO(fmt_str,...)	do{\
 	fprintf(stderr,"\n\r%lu:%s:%s:%d: ",sysGetTickCount(),"INFO",__FUNCTION__,__LINE__); \
 	fprintf(stderr,fmt_str, ##__VA_ARGS__); \
 }while(0)
-#define WARN(fmt_str,...)	do{\
+#define LOG_WARN(fmt_str,...)	do{\
 	fprintf(stderr,"\n\r%lu:%s:%s:%d: ",sysGetTickCount(),"WARN",__FUNCTION__,__LINE__); \
 	fprintf(stderr,fmt_str, ##__VA_ARGS__); \
 }while(0)
-#define ERROR(fmt_str,...)	do{\
+#define LOG_ERROR(fmt_str,...)	do{\
 	fprintf(stderr,"\n\r%lu:%s:%s:%d: ",sysGetTickCount(),"ERR ",__FUNCTION__,__LINE__); \
 	fprintf(stderr,fmt_str, ##__VA_ARGS__); \
 }while(0)
-#define CRITICAL(fmt_str,...)	do{\
+#define LOG_CRITICAL(fmt_str,...)	do{\
 	fprintf(stderr,"\n\r%lu:%s:%s:%d: ",sysGetTickCount(),"CRIT",__FUNCTION__,__LINE__); \
 	fprintf(stderr,fmt_str, ##__VA_ARGS__); \
 	fprintf(stderr,"\n\r+++ System Stopped +++"); \
@@ -112,27 +190,62 @@ typedef struct
 }while(0)
 #endif
 
-// According to LOG_LEVEL specified, set unwanted messages to null
-#if LOG_LEVEL <= 3
-#undef INFO
+// With LOG_RATE_LIMIT each call site has a token bucket and a row in the
+// LOG_TABLE. logAllow() also coalesces repeats of the last message logged
+#ifdef LOG_RATE_LIMIT
+#define LOG_SITE(logLevel,fmt_str) \
+	static volatile logSite_t logSite = {.tokens = LOG_BURST}; \
+	const static logSiteDescr_t SECTION(LOG_TABLE) logSiteDescr = {.fmt = fmt_str, .state = &logSite, .level = logLevel};
+#define LOG_ALLOW()		logAllow(&logSiteDescr)
+#else
+#define LOG_SITE(logLevel,fmt_str)
+#define LOG_ALLOW()		true
+#endif
+
+// According to LOG_LEVEL specified, set unwanted messages to null. The rest
+// are only logged if the runtime level of the current state machine, set with
+// logSetLevel() or the "log" command, allows them. The check comes before any
+// formatting. Critical messages are always logged. With SYS_CRASH the messages
+// logged are also added to the crash record, and a critical error completes it
+#if LOG_LEVEL > 3
+#define INFO(fmt_str,...)		do{ LOG_SITE(LOG_LEVEL_INFO,fmt_str) if(logGetLevel() >= LOG_LEVEL_INFO && LOG_ALLOW()) { CRASH_LOG(LOG_LEVEL_INFO,fmt_str); LOG_INFO(fmt_str, ##__VA_ARGS__); } }while(0)
+#else
 #define INFO(...)
 #endif
-#if LOG_LEVEL <= 2
-#undef WARN
+#if LOG_LEVEL > 2
+#define WARN(fmt_str,...)		do{ LOG_SITE(LOG_LEVEL_WARN,fmt_str) if(logGetLevel() >= LOG_LEVEL_WARN && LOG_ALLOW()) { CRASH_LOG(LOG_LEVEL_WARN,fmt_str); LOG_WARN(fmt_str, ##__VA_ARGS__); } }while(0)
+#else
 #define WARN(...)
 #endif
-#if LOG_LEVEL <= 1
-#undef ERROR
+#if LOG_LEVEL > 1
+#define ERROR(fmt_str,...)		do{ LOG_SITE(LOG_LEVEL_ERR,fmt_str) if(logGetLevel() >= LOG_LEVEL_ERR && LOG_ALLOW()) { CRASH_LOG(LOG_LEVEL_ERR,fmt_str); LOG_ERROR(fmt_str, ##__VA_ARGS__); } }while(0)
+#else
 #define ERROR(...)
 #endif
-#if LOG_LEVEL <=1
-#undef CRITICAL
+#if LOG_LEVEL > 1
+#define CRITICAL(fmt_str,...)	do{ CRASH_SAVE(fmt_str); LOG_CRITICAL(fmt_str, ##__VA_ARGS__); }while(0)
+#else
 #define CRITICAL(...)
 #endif
 
 // External Functions ---------------------------------------------------------
+extern uint8_t logInitLevel;
+
+// Runtime log level of the current state machine. Code that isn't running in a
+// state machine, like the initializers, uses logInitLevel
+static inline uint8_t logGetLevel()
+{
+	volatile fsmStateMachine_t *stateMachine = fsmGetCurrentStateMachine();
+
+	return(stateMachine != NULL ? stateMachine->logLevel : logInitLevel);
+}
+
+void logSetLevel(volatile fsmStateMachine_t *stateMachine, logLevel_t level);
+bool logAllow(const logSiteDescr_t *site);
 void logRam();
 void logRom();
 void logNewLine();
+void logDefer(const char *fmt, logLevel_t level, uint8_t *record, uint8_t length);
+void logFlush();
 
 #endif /* LOG_H_ */
@@ -31,13 +31,15 @@ static uint32_t	pcmDelay = 0;
 #ifdef PCM_SERVICE
 // Create instance of the pcm state machine
 ADD_STATE_MACHINE(pcmStateMachine, pcmInit, false);
+// Create the sample delay timer
+ADD_TIMER(pcmTimer);
 
 // State handler function prototypes
-static int pcmIdle(fsmStateMachine_t *stateMachine);
-static int pcmUpdate(fsmStateMachine_t *stateMachine);
-static int pcmWait(fsmStateMachine_t *stateMachine);
+static int pcmIdle(volatile fsmStateMachine_t *stateMachine);
+static int pcmUpdate(volatile fsmStateMachine_t *stateMachine);
+static int pcmWait(volatile fsmStateMachine_t *stateMachine);
 
-int pcmInit(fsmStateMachine_t *stateMachine)
+int pcmInit(volatile fsmStateMachine_t *stateMachine)
 {
 	// Initialize the DAC
 	dacInit(VREF_REFSEL_VDD_gc,DAC_MID);
@@ -46,7 +48,7 @@ int pcmInit(fsmStateMachine_t *stateMachine)
 	return(0);
 }
 
-static int pcmIdle(fsmStateMachine_t *stateMachine)
+static int pcmIdle(volatile fsmStateMachine_t *stateMachine)
 {
 	// If there is a pcm stream queued...
 	if(pcmLength)
@@ -55,7 +57,7 @@ static int pcmIdle(fsmStateMachine_t *stateMachine)
 	return(0);
 }
 
-static int pcmUpdate(fsmStateMachine_t *stateMachine)
+static int pcmUpdate(volatile fsmStateMachine_t *stateMachine)
 {
 	// Write the next byte in the data stream to the DAC output
 	if(pcmRLECount)
@@ -87,7 +89,7 @@ static int pcmUpdate(fsmStateMachine_t *stateMachine)
 	return(0);
 }
 
-static int pcmWait(fsmStateMachine_t *stateMachine)
+static int pcmWait(volatile fsmStateMachine_t *stateMachine)
 {
 	// If the wait timer expired...
 	if(tmrOnDelay(&pcmTimer,pcmDelay))
@@ -104,6 +106,9 @@ static int pcmWait(fsmStateMachine_t *stateMachine)
 			fsmSetNextState(stateMachine, pcmIdle);
 		}
 	}
+	// Else wait for the timer to expire
+	else
+		evntWait(tmrGetEvent(&pcmTimer),TMR_EVENT_EXPIRED);
 	return(0);
 }
 #endif // PCM_SERVICE
@@ -0,0 +1,225 @@
+/*
+ * crash.c
+ *
+ * Crash record. The dispatcher and the logger keep a record of the running
+ * system in a .noinit RAM section, which isn't cleared at reset. At boot the
+ * record of the last run is kept if it ended in a critical error, watchdog or
+ * brown-out reset. With CRASH_EEPROM it's also written to EEPROM, so it
+ * survives a power cycle
+ *
+ * Copyright (C) 2021 by John Anderson <racerxr650r@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR
+ * IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../avrOS.h"
+
+#ifdef SYS_CRASH
+#ifdef CRASH_EEPROM
+#include <avr/eeprom.h>
+#endif
+
+// Globals --------------------------------------------------------------------
+// Record of the running system and the record of the last crash
+crashRecord_t __attribute__((section(".noinit"))) crashRecord;
+static crashRecord_t __attribute__((section(".noinit"))) crashLast;
+#ifdef CRASH_EEPROM
+static crashRecord_t EEMEM crashEeprom;
+#endif
+// Set when the last run ended in a crash, for crashReport()
+static bool crashNew = false;
+
+static const char *crashReasons[] = {"None","Critical error","Watchdog reset","Brown-out reset"};
+static const char *crashLevels[] = {"?   ","CRIT","ERR ","WARN","INFO"};
+
+// Command line interface -----------------------------------------------------
+#ifdef SYS_CLI
+ADD_COMMAND("crash",crashCmd);
+static int crashCmd(int argc, char *argv[])
+{
+	int ret = 0;
+
+	if(argc == 1)
+		crashDump(stdout);
+	else if(argc == 2 && !strcmp(argv[1],"clear"))
+		crashClear();
+	else
+		ret = -1;
+
+	return(ret);
+}
+#endif // SYS_CLI
+
+// Internal Functions ---------------------------------------------------------
+// Name from the record, which is NULL if it wasn't set
+static const char *crashName(const char *name)
+{
+	return(name != NULL ? name : "-");
+}
+
+// Name of the crash reason. The record may be corrupt, so it's range checked
+static const char *crashReasonName(uint8_t reason)
+{
+	return(crashReasons[reason < sizeof(crashReasons)/sizeof(crashReasons[0]) ? reason : 0]);
+}
+
+// External Functions ---------------------------------------------------------
+// Check the record of the last run and start a new one. Call before the stack
+// is filled, so the stack high-water mark of the last run can still be read
+void crashInit()
+{
+	uint8_t	flags = RSTCTRL.RSTFR;
+
+	// Clear the reset flags for the next reset
+	RSTCTRL.RSTFR = flags;
+
+	// After a power-on reset the RAM is undefined. After a UPDI reset the
+	// firmware may have changed, so the names in the record can't be trusted
+	if(!(flags & (RSTCTRL_PORF_bm | RSTCTRL_UPDIRF_bm)) && crashRecord.magic == CRASH_MAGIC)
+	{
+		if(crashRecord.reason == CRASH_NONE)
+		{
+			if(flags & RSTCTRL_WDRF_bm)
+				crashRecord.reason = CRASH_WATCHDOG;
+			else if(flags & RSTCTRL_BORF_bm)
+				crashRecord.reason = CRASH_BROWNOUT;
+		}
+
+		// Software and external resets aren't crashes
+		if(crashRecord.reason != CRASH_NONE)
+		{
+			crashRecord.resetFlags = flags;
+			if(!crashRecord.stackMax)
+				crashRecord.stackMax = memStackSizeMax();
+			crashLast = crashRecord;
+			crashNew = true;
+#ifdef CRASH_EEPROM
+			eeprom_update_block(&crashLast,&crashEeprom,sizeof(crashLast));
+#endif
+		}
+	}
+	else if(flags & (RSTCTRL_PORF_bm | RSTCTRL_UPDIRF_bm))
+	{
+#ifdef CRASH_EEPROM
+		eeprom_read_block(&crashLast,&crashEeprom,sizeof(crashLast));
+		if(crashLast.magic != CRASH_MAGIC || (flags & RSTCTRL_UPDIRF_bm))
+#endif
+			crashLast.magic = 0;
+	}
+
+	// Start the record of this run
+	memset(&crashRecord,0,sizeof(crashRecord));
+	crashRecord.magic = CRASH_MAGIC;
+}
+
+// Log the crash of the last run, if there was one. Call once the log is open
+void crashReport()
+{
+	if(!crashNew)
+		return;
+
+	ERROR("%s in %s:%s at tick %lu, reset flags 0x%02x",crashReasonName(crashLast.reason),crashName(crashLast.stateMachine),crashName(crashLast.state),crashLast.tick,crashLast.resetFlags);
+	if(crashLast.message != NULL)
+		ERROR("Critical error: %s",crashLast.message);
+	ERROR("Max stack %u bytes, \"crash\" command for more",crashLast.stackMax);
+}
+
+// Add a log message to the ring of recent messages
+void crashAddLog(uint8_t level, const char *fmt)
+{
+	crashLog_t	*log;
+
+	// Start critical section of code
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		log = &crashRecord.log[crashRecord.logNext];
+		log->tick = sysGetTickCount();
+		log->fmt = fmt;
+		log->level = level;
+		if(++crashRecord.logNext == CRASH_LOG_SIZE)
+			crashRecord.logNext = 0;
+	}
+}
+
+// Complete the record for a critical error. The system stops after this, so
+// with CRASH_EEPROM the record is written to EEPROM now rather than at the
+// next boot, in case the next reset is a power cycle
+void crashSave(const char *fmt)
+{
+	volatile fsmStateMachine_t *stateMachine = fsmGetCurrentStateMachine();
+
+	if(stateMachine != NULL)
+		crashSetState(stateMachine);
+	else
+	{
+		crashRecord.stateMachine = fsmGetCurrentStateMachineName();
+		crashRecord.state = NULL;
+		crashRecord.prevState = NULL;
+		crashRecord.tick = sysGetTickCount();
+	}
+	crashRecord.reason = CRASH_CRITICAL;
+	crashRecord.message = fmt;
+	crashRecord.stackMax = memStackSizeMax();
+#ifdef CRASH_EEPROM
+	eeprom_update_block(&crashRecord,&crashEeprom,sizeof(crashRecord));
+#endif
+}
+
+// Return: The record of the last crash, NULL if there isn't one
+const crashRecord_t *crashGetLast()
+{
+	return(crashLast.magic == CRASH_MAGIC ? &crashLast : NULL);
+}
+
+// Forget the last crash
+void crashClear()
+{
+	crashLast.magic = 0;
+	crashNew = false;
+#ifdef CRASH_EEPROM
+	eeprom_update_block(&crashLast,&crashEeprom,sizeof(crashLast.magic));
+#endif
+}
+
+// Print the record of the last crash, with the recent log messages oldest first
+void crashDump(FILE *file)
+{
+	const crashRecord_t	*crash = crashGetLast();
+	uint8_t				i, index;
+
+	if(crash == NULL)
+	{
+		fprintf(file,"No crash recorded\n\r");
+		return;
+	}
+
+	fprintf(file,BOLD FG_BLUE "        Reason: " RESET "%s\n\r",crashReasonName(crash->reason));
+	fprintf(file,BOLD FG_BLUE "   Reset Flags: " RESET "0x%02x\n\r",crash->resetFlags);
+	fprintf(file,BOLD FG_BLUE "          Tick: " RESET "%lu\n\r",crash->tick);
+	fprintf(file,BOLD FG_BLUE " State Machine: " RESET "%s\n\r",crashName(crash->stateMachine));
+	fprintf(file,BOLD FG_BLUE "         State: " RESET "%s\n\r",crashName(crash->state));
+	fprintf(file,BOLD FG_BLUE "    Prev State: " RESET "%s\n\r",crashName(crash->prevState));
+	fprintf(file,BOLD FG_BLUE "     Max Stack: " RESET "%u\n\r",crash->stackMax);
+	if(crash->message != NULL)
+		fprintf(file,BOLD FG_BLUE "       Message: " RESET "%s\n\r",crash->message);
+
+	fprintf(file,BOLD UNDERLINE FG_BLUE "Recent Log" RESET "\n\r");
+	for(i=0,index=crash->logNext;i<CRASH_LOG_SIZE;++i)
+	{
+		const crashLog_t *log = &crash->log[index];
+
+		if(log->fmt != NULL)
+			fprintf(file,"%10lu:%s: %s\n\r",log->tick,crashLevels[log->level < sizeof(crashLevels)/sizeof(crashLevels[0]) ? log->level : 0],log->fmt);
+		if(++index == CRASH_LOG_SIZE)
+			index = 0;
+	}
+}
+#endif // SYS_CRASH
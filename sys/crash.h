@@ -0,0 +1,100 @@
+/*
+ * crash.h
+ *
+ * Header for the crash record. Keeps the state of the running system in RAM
+ * that isn't cleared at reset, so the cause of a critical error, watchdog or
+ * brown-out reset can be reported on the next boot and by the "crash" CLI
+ * command
+ *
+ * Copyright (C) 2021 by John Anderson <racerxr650r@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR
+ * IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef CRASH_H_
+#define CRASH_H_
+
+// Constants ------------------------------------------------------------------
+#ifndef CRASH_LOG_SIZE
+#define CRASH_LOG_SIZE	8		// Number of recent log messages in the crash record
+#endif
+
+#define CRASH_MAGIC		0xc4a5	// Marks a crash record written by this firmware
+
+// Types ----------------------------------------------------------------------
+// Cause of the crash
+typedef enum
+{
+	CRASH_NONE = 0,
+	CRASH_CRITICAL,		// CRITICAL() message
+	CRASH_WATCHDOG,		// Watchdog reset
+	CRASH_BROWNOUT		// Brown-out reset
+} crashReason_t;
+
+// Recent log message. Only the format string is kept, not the arguments
+typedef struct
+{
+	uint32_t	tick;
+	const char	*fmt;
+	uint8_t		level;			// logLevel_t
+} crashLog_t;
+
+// Crash record. The strings are constants in flash, so the pointers are still
+// valid after a reset as long as the firmware isn't changed
+typedef struct
+{
+	uint16_t	magic;			// CRASH_MAGIC if the record is valid
+	uint8_t		reason;			// crashReason_t
+	uint8_t		resetFlags;		// RSTCTRL.RSTFR of the reset that followed
+	uint32_t	tick;			// System tick of the last state dispatched or the critical error
+	const char	*stateMachine;	// Name of the last state machine dispatched
+	const char	*state;			// Name of its current state
+	const char	*prevState;		// Name of its previous state
+	const char	*message;		// Format string of the critical error
+	uint16_t	stackMax;		// Stack high-water mark in bytes
+	uint8_t		logNext;		// Next entry of the log ring
+	crashLog_t	log[CRASH_LOG_SIZE];
+} crashRecord_t;
+
+// Macros ---------------------------------------------------------------------
+#ifdef SYS_CRASH
+#define CRASH_STATE(stateMachine)	crashSetState(stateMachine)
+#define CRASH_LOG(level,fmt)		crashAddLog(level,fmt)
+#define CRASH_SAVE(fmt)				crashSave(fmt)
+#else
+#define CRASH_STATE(stateMachine)
+#define CRASH_LOG(level,fmt)
+#define CRASH_SAVE(fmt)
+#endif
+
+// External Functions ---------------------------------------------------------
+extern crashRecord_t crashRecord;
+
+// Record the state machine the dispatcher is about to call. Called for each
+// state handler call, so it only copies a few pointers and the tick
+static inline void crashSetState(volatile fsmStateMachine_t *stateMachine)
+{
+	crashRecord.stateMachine = stateMachine->stateMachineDescr->name;
+	crashRecord.state = stateMachine->currStateName;
+	crashRecord.prevState = stateMachine->prevStateName;
+	crashRecord.tick = sysGetTickCount();
+}
+
+void crashInit();
+void crashReport();
+void crashAddLog(uint8_t level, const char *fmt);
+void crashSave(const char *fmt);
+const crashRecord_t *crashGetLast();
+void crashClear();
+void crashDump(FILE *file);
+
+#endif /* CRASH_H_ */
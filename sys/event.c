@@ -26,7 +26,10 @@
 extern void *__start_EVNT_TABLE,*__stop_EVNT_TABLE;
 
 // Locals ----------------------------------------------------------------------
-ADD_QUEUE(evntQue,sizeof(event_t *),4);
+// Pending bitmap, one bit per event indexed by position in the EVNT_TABLE, and
+// a summary byte with one bit per non-zero bitmap byte
+static uint8_t	evntPendingBits[(EVNT_MAX_EVENTS+7)/8];
+static uint8_t	evntPendingGrp = 0;
 
 // Command line interface ------------------------------------------------------
 #ifdef EVNT_CLI
@@ -46,9 +49,9 @@ static int evntCmd(int argc, char *argv[])
 #ifdef EVNT_STATS
 			printf(UNDERLINE BOLD FG_BLUE "%-24s",descr->name);
 #endif
-			printf(UNDERLINE BOLD FG_BLUE "%s\n\r" RESET,descr->status->handler==NULL?"unarmed":"armed");
+			printf(UNDERLINE BOLD FG_BLUE "%s\n\r" RESET,evntGetStatus(descr->status)==EVENT_ARMED?"armed":"unarmed");
 #ifdef EVNT_STATS
-			printf("\tArmed: %8lu Triggered: %8lu  Handled: %8lu Unhandled: %8lu Error: %8lu\n\r",descr->status->stats.armed,descr->status->stats.handled+descr->status->stats.unhandled,descr->status->stats.handled,descr->status->stats.unhandled,descr->status->stats.error);
+			printf("\tArmed: %8lu Triggered: %8lu  Handled: %8lu Unhandled: %8lu Error: %8lu Coalesced: %8lu\n\r",descr->status->stats.armed,descr->status->stats.handled+descr->status->stats.unhandled,descr->status->stats.handled,descr->status->stats.unhandled,descr->status->stats.error,descr->status->stats.coalesced);
 #endif
 			ret = 0;
 		}
@@ -73,12 +76,11 @@ volatile event_t* evntGetEvent(char *name)
 
 evntState_t evntGetStatus(volatile event_t *event)
 {
-	evntState_t    ret = EVENT_IDLE;
+	evntState_t    ret = EVENT_DISARMED;
 
-	if(event->handler)
-		ret = EVENT_ARMED;
-	else
-		ret = EVENT_DISARMED;
+	for(uint8_t i = 0; i < EVNT_SUBSCRIBERS; ++i)
+		if(event->subscribers[i].handler)
+			ret = EVENT_ARMED;
 
 	return(ret);
 }
@@ -88,44 +90,92 @@ evntState_t evntReset(volatile event_t *event)
 	// Start critical section of code
 	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 	{
-		event->stateMachine = NULL;
-		event->handler = NULL;
+		for(uint8_t i = 0; i < EVNT_SUBSCRIBERS; ++i)
+		{
+			event->subscribers[i].stateMachine = NULL;
+			event->subscribers[i].handler = NULL;
+		}
 	} // End critical section of code
 	return(EVENT_DISARMED);
 }
 
+// Return the subscriber slot of the given state machine, or of the handler if
+// there is no state machine. Returns NULL if not subscribed
+static volatile evntSubscriber_t *evntFindSubscriber(volatile event_t *event, evntHandler_t handler, volatile fsmStateMachine_t *stateMachine)
+{
+	for(uint8_t i = 0; i < EVNT_SUBSCRIBERS; ++i)
+	{
+		volatile evntSubscriber_t *sub = &event->subscribers[i];
+
+		if(sub->handler != NULL && sub->stateMachine == stateMachine && (stateMachine != NULL || sub->handler == handler))
+			return(sub);
+	}
+
+	return(NULL);
+}
+
+// Subscribe the handler/state machine to the event. A state machine (or a
+// handler without a state machine) that is already subscribed has its filter
+// and handler updated. Returns EVENT_ERROR if all the subscriber slots are in
+// use
 evntState_t evntEnable(volatile event_t *event, evntType_t filter, evntHandler_t handler, volatile fsmStateMachine_t *stateMachine)
 {
-	evntState_t ret;
+	evntState_t ret = EVENT_ERROR;
+
+	if(event == NULL)
+		return(EVENT_ERROR);
 
-	// 
-	if(event != NULL && handler != NULL)
+	if(handler != NULL)
 	{
 		// Start critical section of code
 		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 		{
-			// Set up the event
-			event->stateMachine = stateMachine;
-			event->filter = filter;
-			event->handler = handler;
+			volatile evntSubscriber_t *sub = evntFindSubscriber(event, handler, stateMachine);
 
+			// If not already subscribed, take a free slot
+			for(uint8_t i = 0; sub == NULL && i < EVNT_SUBSCRIBERS; ++i)
+				if(event->subscribers[i].handler == NULL)
+					sub = &event->subscribers[i];
+
+			if(sub != NULL)
+			{
+				// Set up the subscriber
+				sub->stateMachine = stateMachine;
+				sub->filter = filter;
+				sub->handler = handler;
+				ret = EVENT_ARMED;
+			}
 		} // End critical section of code
-#ifdef EVNT_STATS
-		++event->stats.armed;
-#endif
-		ret = EVENT_ARMED;
 	}
-	else 
-	{
+
 #ifdef EVNT_STATS
+	if(ret == EVENT_ARMED)
+		++event->stats.armed;
+	else
 		++event->stats.error;
 #endif
-		ret = EVENT_ERROR;
-	}
 
 	return(ret);
 }
 
+// Remove a subscriber added by evntEnable() or evntWait()
+evntState_t evntUnsubscribe(volatile event_t *event, evntHandler_t handler, volatile fsmStateMachine_t *stateMachine)
+{
+	// Start critical section of code
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		volatile evntSubscriber_t *sub = evntFindSubscriber(event, handler, stateMachine);
+
+		if(sub != NULL)
+		{
+			sub->handler = NULL;
+			sub->stateMachine = NULL;
+		}
+	} // End critical section of code
+
+	return(evntGetStatus(event));
+}
+
 evntState_t evntWait(volatile event_t *event, evntType_t filter)
 {
 	// Start critical section of code
@@ -140,37 +190,99 @@ evntState_t evntWait(volatile event_t *event, evntType_t filter)
 	return(EVENT_ARMED);
 }
 
+// Event handler for evntWaitTimeout(). The event won, so the timeout is over
+static int evntWaitTimeoutHandler(volatile fsmStateMachine_t *stateMachine)
+{
+	stateMachine->waitEvent = NULL;
+	return(fsmReady(stateMachine));
+}
+
+// Wait on the event for up to the given number of ticks. The current state
+// machine is made ready by whichever comes first, the event or the timeout.
+// Use evntWaitTimedOut() once ready to find out which one it was. A timeout of
+// 0 ticks waits on the event only. If the event can't be enabled, the state
+// machine is left ready and the error is returned
+evntState_t evntWaitTimeout(volatile event_t *event, evntType_t filter, uint32_t ticks)
+{
+	volatile fsmStateMachine_t	*stateMachine = fsmGetCurrentStateMachine();
+	evntState_t					ret;
+
+	// Start critical section of code
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		stateMachine->timedOut = false;
+		// Enable the event for the current state machine with the given filter
+		ret = evntEnable(event, filter, evntWaitTimeoutHandler, stateMachine);
+		if(ret == EVENT_ARMED)
+		{
+			stateMachine->waitEvent = event;
+			// Put the state machine in the delay queue for the timeout
+			fsmWaitTicks(stateMachine,ticks);
+		}
+	} // End of critical section
+
+	return(ret);
+}
+
+// Returns true if the current state machine was made ready by the timeout of
+// its last evntWaitTimeout(), false if by the event
+bool evntWaitTimedOut(void)
+{
+	return(fsmGetCurrentStateMachine()->timedOut);
+}
+
+// Remove all the subscribers
 evntState_t evntDisable(volatile event_t *event)
 {
-	event->handler = NULL;
-	return(EVENT_DISARMED);
+	return(evntReset(event));
 }
 
 evntState_t evntTrigger(volatile event_t *event, evntType_t type)
 {
 	evntState_t    ret;
+	uint16_t       index = (const evntDescriptor_t *)event->descr - (const evntDescriptor_t *)&__start_EVNT_TABLE;
 
 	// Start critical section of code
 	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 	{
 		// If the event is armed and the type is legit...
-		if(event->handler!=NULL && type != EVENT_TYPE_NONE)
+		if(evntGetStatus(event)==EVENT_ARMED && type != EVENT_TYPE_NONE && index < EVNT_MAX_EVENTS)
 		{
-			// If the type is in the filter, or the filter is "all events"...
-			if(type&event->filter || event->filter==EVENT_TYPE_ALL)
+			bool match = false;
+
+			// If the type is in a subscriber's filter, or the filter is "all
+			// events"...
+			for(uint8_t i = 0; i < EVNT_SUBSCRIBERS; ++i)
+				if(event->subscribers[i].handler != NULL && (type&event->subscribers[i].filter || event->subscribers[i].filter==EVENT_TYPE_ALL))
+					match = true;
+
+			if(match)
 			{
 #ifdef EVNT_STATS
 				++(event->stats.handled);
+				// If the event is already pending, this trigger is merged
+				if(event->pending)
+					++(event->stats.coalesced);
 #endif
-				// Set the type and put the event in the queue
-				event->type = type;
-				quePutPtr(&evntQue,(void *)event);
+				// Add the type to the pending types and mark the event pending
+				event->pending |= type;
+				evntPendingBits[index>>3] |= 1<<(index&0x07);
+				evntPendingGrp |= 1<<(index>>3);
+				TRACE(TRC_EVNT_TRIGGER,type,event,0);
 
 				ret = EVENT_TRIGGERED;
 			}
+			else
+			{
+				ret = EVENT_IDLE;
+#ifdef EVNT_STATS
+				++event->stats.unhandled;
+#endif
+			}
 		}
-		// Else if the trigger type is "no event"...
-		else if(type==EVENT_TYPE_NONE)
+		// Else if the trigger type is "no event", or the event is beyond the
+		// pending bitmap...
+		else if(type==EVENT_TYPE_NONE || index >= EVNT_MAX_EVENTS)
 		{
 			ret = EVENT_ERROR;
 #ifdef EVNT_STATS
@@ -190,23 +302,113 @@ evntState_t evntTrigger(volatile event_t *event, evntType_t type)
 	return(ret);
 }
 
+// Return true if there are triggered events waiting to be dispatched
+bool evntPending(void)
+{
+	return(evntPendingGrp != 0);
+}
+
+// Return the priority of the highest priority subscriber. Subscribers without
+// a state machine (system handlers) have the highest priority
+static uint8_t evntGetPriority(volatile event_t *event)
+{
+	uint8_t	ret = 0xff;
+
+	for(uint8_t i = 0; i < EVNT_SUBSCRIBERS; ++i)
+	{
+		volatile evntSubscriber_t *sub = &event->subscribers[i];
+
+		if(sub->handler != NULL)
+		{
+			uint8_t priority = sub->stateMachine?sub->stateMachine->stateMachineDescr->priority:0;
+
+			if(priority < ret)
+				ret = priority;
+		}
+	}
+
+	return(ret);
+}
+
+// Return the pending event with the highest priority subscriber and clear its
+// pending bit. Ties go to the event first in the EVNT_TABLE
+static volatile event_t *evntGetNext(void)
+{
+	evntDescriptor_t	*table = (evntDescriptor_t *)&__start_EVNT_TABLE;
+	volatile event_t	*ret = NULL;
+	uint8_t				retIndex = 0, retPriority = 0;
+
+	// Start critical section of code
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		// Walk the pending bits
+		for(uint8_t grp = 0; grp < sizeof(evntPendingBits); ++grp)
+		{
+			if(!(evntPendingGrp & (1<<grp)))
+				continue;
+
+			for(uint8_t bit = 0; bit < 8; ++bit)
+				if(evntPendingBits[grp] & (1<<bit))
+				{
+					volatile event_t	*event = table[(grp<<3)|bit].status;
+					uint8_t				priority = evntGetPriority(event);
+
+					if(ret == NULL || priority < retPriority)
+					{
+						ret = event;
+						retIndex = (grp<<3)|bit;
+						retPriority = priority;
+					}
+				}
+		}
+
+		if(ret != NULL)
+		{
+			// Clear the pending bit
+			evntPendingBits[retIndex>>3] &= ~(1<<(retIndex&0x07));
+			if(!evntPendingBits[retIndex>>3])
+				evntPendingGrp &= ~(1<<(retIndex>>3));
+			// Deliver the pending types
+			ret->type = ret->pending;
+			ret->pending = EVENT_TYPE_NONE;
+		}
+	} // End critical section
+
+	return(ret);
+}
+
 int evntDispatch(void)
 {
 	int     ret = 0;
-	event_t *event;
+	volatile event_t *event;
 
-	// While there are events in the queue...
-	while(queGetPtr(&evntQue,(void **)&event) == true)
+	// While there are events pending...
+	while((event = evntGetNext()) != NULL)
 	{
-		// Call the event handler for the event
-		if(!event->handler(event->stateMachine))
+		TRACE(TRC_EVNT_DISPATCH,event->type,event,0);
+
+		// Call every subscriber whose filter matches the delivered types. A
+		// subscriber disabled after the event was triggered is skipped
+		for(uint8_t i = 0; i < EVNT_SUBSCRIBERS; ++i)
 		{
-			// If this event has a state machine assigned...
-			if(event->stateMachine)
+			volatile evntSubscriber_t	*sub = &event->subscribers[i];
+			evntHandler_t				handler = sub->handler;
+			volatile fsmStateMachine_t	*stateMachine = sub->stateMachine;
+
+			if(handler == NULL || !(event->type&sub->filter || sub->filter==EVENT_TYPE_ALL))
+				continue;
+
+			// Call the event handler for the subscriber
+			if(!handler(stateMachine))
 			{
-				// Disarm the event
-				event->handler = NULL;
-				event->stateMachine = NULL;
+				// If this subscriber is a state machine and the handler didn't
+				// change the subscription...
+				if(stateMachine && sub->handler == handler && sub->stateMachine == stateMachine)
+				{
+					// Disarm the subscriber
+					sub->handler = NULL;
+					sub->stateMachine = NULL;
+				}
 			}
 		}
 
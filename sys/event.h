@@ -56,16 +56,31 @@ struct EVENT_TYPE;
 
 typedef struct EVENT_STATS
 {
-	uint32_t	armed, handled, unhandled, error;
+	uint32_t	armed, handled, unhandled, error, coalesced;
 }evntStats_t;
 
-typedef struct EVENT_TYPE
+// Constants -------------------------------------------------------------------
+#ifndef EVNT_MAX_EVENTS
+#define EVNT_MAX_EVENTS	64		// Maximum number of events in the EVNT_TABLE (64 max)
+#endif
+#ifndef EVNT_SUBSCRIBERS
+#define EVNT_SUBSCRIBERS	2	// Number of handlers/state machines that can wait on an event
+#endif
+
+typedef struct EVENT_SUBSCRIBER_TYPE
 {
-	evntType_t        				type, filter;
+	evntType_t						filter;
 	volatile fsmStateMachine_t 		*stateMachine;
-	evntHandler_t     				handler;
-#ifdef EVNT_STATS
+	evntHandler_t     				handler;		// NULL if the subscriber slot is free
+}evntSubscriber_t;
+
+typedef struct EVENT_TYPE
+{
+	evntType_t        				type;			// Types delivered by the current dispatch
+	evntType_t						pending;		// Types triggered since the last dispatch
+	evntSubscriber_t				subscribers[EVNT_SUBSCRIBERS];
 	const struct EVENT_DESCR_TYPE 	*descr;
+#ifdef EVNT_STATS
 	evntStats_t       	stats;
 #endif
 }event_t;
@@ -77,24 +92,32 @@ typedef struct EVENT_DESCR_TYPE
 }evntDescriptor_t;
 
 // Macros ----------------------------------------------------------------------
+// Every event has a descriptor in the EVNT_TABLE. The position of the
+// descriptor in the table indexes the event's pending bit
 #ifdef EVNT_STATS
 #define ADD_EVENT(evntName)	\
 		volatile static event_t	evntName; \
 		const static evntDescriptor_t SECTION(EVNT_TABLE) CONCAT(evntName,_descr) = {.name = #evntName, .status = &evntName}; \
-		volatile static event_t	evntName = {.type = EVENT_TYPE_NONE, .filter = EVENT_TYPE_ALL, .stateMachine = NULL, .handler = NULL, .descr = &CONCAT(evntName,_descr), .stats.armed = 0, .stats.handled = 0, .stats.unhandled = 0, .stats.error = 0};
+		volatile static event_t	evntName = {.type = EVENT_TYPE_NONE, .pending = EVENT_TYPE_NONE, .descr = &CONCAT(evntName,_descr), .stats.armed = 0, .stats.handled = 0, .stats.unhandled = 0, .stats.error = 0, .stats.coalesced = 0};
 #else
 #define ADD_EVENT(evntName)	\
 		volatile static event_t	evntName; \
-		volatile static event_t	evntName = {.type = EVENT_TYPE_NONE, .filter = EVENT_TYPE_ALL, .stateMachine = NULL, .handler = NULL};
+		const static evntDescriptor_t SECTION(EVNT_TABLE) CONCAT(evntName,_descr) = {.name = #evntName, .status = &evntName}; \
+		volatile static event_t	evntName = {.type = EVENT_TYPE_NONE, .pending = EVENT_TYPE_NONE, .descr = &CONCAT(evntName,_descr)};
 #endif
 
 // External Functions ----------------------------------------------------------
 volatile event_t* evntGetEvent(char *name);
+evntState_t evntGetStatus(volatile event_t *event);
 evntState_t evntReset(volatile event_t *event);
 evntState_t evntEnable(volatile event_t *event, evntType_t filter, evntHandler_t handler, volatile fsmStateMachine_t *stateMachine);
 evntState_t evntWait(volatile event_t *event, evntType_t filter);
+evntState_t evntWaitTimeout(volatile event_t *event, evntType_t filter, uint32_t ticks);
+bool evntWaitTimedOut(void);
 evntState_t evntDisable(volatile event_t *event);
+evntState_t evntUnsubscribe(volatile event_t *event, evntHandler_t handler, volatile fsmStateMachine_t *stateMachine);
 evntState_t evntTrigger(volatile event_t *event, evntType_t type);
 int evntDispatch(void);
+bool evntPending(void);
 
 #endif  // EVENT_H_
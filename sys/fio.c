@@ -0,0 +1,369 @@
+/*
+ * fio.c
+ *
+ * Integer only formatted output for file streams. The text is formatted
+ * straight into the file's output queue, a contiguous span at a time, instead
+ * of a character at a time through the stream's put function
+ *
+ * Copyright (C) 2021 by John Anderson <racerxr650r@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR
+ * IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+// Includes -------------------------------------------------------------------
+#include "../avrOS.h"
+
+// The macros would rename the functions below
+#undef printf
+#undef fprintf
+
+// Constants ------------------------------------------------------------------
+// Room for a number converted to text, with its sign, 0x and precision. A
+// precision over 36 digits is cut short
+#define FIO_NUMBER_SIZE		40
+
+// Types ----------------------------------------------------------------------
+// Where the formatted text goes
+typedef struct
+{
+	FILE				*file;
+	volatile queue_t	*que;		// Output queue, or NULL to use the put function
+	char				*span;		// Next free byte of the reserved span
+	uint16_t			room;		// Bytes left in the reserved span
+	uint16_t			used;		// Bytes written to the reserved span
+	uint16_t			count;		// Bytes output
+	uint16_t			dropped;	// Bytes that didn't fit in the queue
+}fioSink_t;
+
+// Internal Functions ---------------------------------------------------------
+// Add the bytes written to the reserved span to the queue and end the
+// reservation. Other producers can't put to the queue while it's reserved
+static void fioCommit(fioSink_t *sink)
+{
+	if(sink->used || sink->room)
+	{
+		queCommit(sink->que,sink->used);
+		sink->count += sink->used;
+		sink->used = 0;
+		sink->room = 0;
+	}
+}
+
+// Output a character
+static void fioPut(fioSink_t *sink, char c)
+{
+	if(sink->que == NULL)
+	{
+		if(sink->file->put(c,sink->file) == 0)
+			++sink->count;
+		return;
+	}
+
+	// If the span is full, commit it and reserve the next one
+	if(!sink->room && !sink->dropped)
+	{
+		fioCommit(sink);
+		sink->room = queReserve(sink->que,QUE_MAX_SIZE,(void **)&sink->span);
+	}
+
+	if(sink->room)
+	{
+		*sink->span++ = c;
+		--sink->room;
+		++sink->used;
+	}
+	// Else the queue is full. Drop the rest, so the output isn't reordered
+	else
+		++sink->dropped;
+}
+
+// Output the padding of a field
+static void fioPad(fioSink_t *sink, char pad, uint8_t length, uint8_t width)
+{
+	for(;length<width;++length)
+		fioPut(sink,pad);
+}
+
+// Output a string padded to width. The first prefix characters, a sign or 0x,
+// go ahead of zero padding
+static void fioPutPadded(fioSink_t *sink, const char *str, uint8_t length, uint8_t prefix, uint8_t width, bool left, char pad)
+{
+	uint8_t	i;
+
+	if(pad == '0')
+		for(;prefix;--prefix,--length)
+		{
+			fioPut(sink,*str++);
+			if(width)
+				--width;
+		}
+	if(!left)
+		fioPad(sink,pad,length,width);
+	for(i=0;i<length;++i)
+		fioPut(sink,str[i]);
+	if(left)
+		fioPad(sink,' ',length,width);
+}
+
+// Convert a number to text, ending at end. 16 bit values use the faster 16 bit
+// division
+// Return: Pointer to the first character
+static char *fioNumber(char *end, uint32_t value, uint8_t base, bool upper)
+{
+	const char	*digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+
+	if(value <= 0xffff)
+	{
+		uint16_t value16 = value;
+
+		do
+		{
+			*--end = digits[value16 % base];
+			value16 /= base;
+		}while(value16);
+	}
+	else
+	{
+		do
+		{
+			*--end = digits[value % base];
+			value /= base;
+		}while(value);
+	}
+	return(end);
+}
+
+// External Functions ---------------------------------------------------------
+// Formatted output to a file stream like fprintf(), for %d %i %u %o %x %X %p
+// %c %s %S and %%, with the - 0 + space and # flags, field width, precision
+// and the h and l length modifiers. Floating point conversions print a ? like
+// the avr-libc printf without the float library. If the file has an output
+// queue, the text is written straight into it. Text that doesn't fit in the
+// queue is dropped
+// Return: The number of characters output, -1 if file is NULL
+int fioPrintf(FILE *file, const char *fmt, ...)
+{
+	va_list	args;
+	int		ret;
+
+	va_start(args,fmt);
+	ret = fioVPrintf(file,fmt,args);
+	va_end(args);
+
+	return(ret);
+}
+
+// fioPrintf() with a va_list
+int fioVPrintf(FILE *file, const char *fmt, va_list args)
+{
+	fioBuffers_t	*buffers;
+	fioSink_t		sink = {.file = file, .que = NULL, .room = 0, .used = 0, .count = 0, .dropped = 0};
+	char			buff[FIO_NUMBER_SIZE], *str;
+
+	if(file == NULL)
+		return(-1);
+
+	buffers = (fioBuffers_t *)file->buf;
+	if(buffers != NULL)
+		sink.que = buffers->output;
+
+	while(*fmt)
+	{
+		bool		left = false, longArg = false, alt = false;
+		char		pad = ' ', sign = 0;
+		uint8_t		width = 0, base = 0, prefix = 0;
+		int16_t		precision = -1;
+		uint32_t	value = 0;
+
+		if(*fmt != '%')
+		{
+			fioPut(&sink,*fmt++);
+			continue;
+		}
+		++fmt;
+
+		// Flags
+		for(;;++fmt)
+		{
+			if(*fmt == '-')
+				left = true;
+			else if(*fmt == '0')
+				pad = '0';
+			else if(*fmt == '+')
+				sign = '+';
+			else if(*fmt == ' ')
+				sign = sign ? sign : ' ';
+			else if(*fmt == '#')
+				alt = true;
+			else
+				break;
+		}
+
+		// Width and precision, * takes them from the arguments
+		if(*fmt == '*')
+		{
+			int arg = va_arg(args,int);
+
+			if(arg < 0)
+			{
+				left = true;
+				arg = -arg;
+			}
+			width = arg > 255 ? 255 : arg;
+			++fmt;
+		}
+		else
+			while(*fmt >= '0' && *fmt <= '9')
+				width = width*10 + *fmt++ - '0';
+		if(*fmt == '.')
+		{
+			precision = 0;
+			if(*++fmt == '*')
+			{
+				int arg = va_arg(args,int);
+
+				precision = arg < 0 ? -1 : arg > 255 ? 255 : arg;
+				++fmt;
+			}
+			else
+				while(*fmt >= '0' && *fmt <= '9')
+					if((precision = precision*10 + *fmt++ - '0') > 255)
+						precision = 255;
+		}
+
+		// Length modifiers, h and hh arguments are passed as int
+		while(*fmt == 'h' || *fmt == 'l')
+			longArg |= *fmt++ == 'l';
+
+		str = &buff[sizeof(buff)];
+		switch(*fmt)
+		{
+			case 'd':
+			case 'i':
+			{
+				int32_t	number = longArg ? va_arg(args,int32_t) : va_arg(args,int);
+
+				value = number < 0 ? -(uint32_t)number : (uint32_t)number;
+				if(number < 0)
+					sign = '-';
+				base = 10;
+				break;
+			}
+			case 'u':
+			case 'o':
+			case 'x':
+			case 'X':
+				value = longArg ? va_arg(args,uint32_t) : va_arg(args,unsigned int);
+				base = *fmt == 'u' ? 10 : *fmt == 'o' ? 8 : 16;
+				sign = 0;
+				break;
+			case 'p':
+				value = (uintptr_t)va_arg(args,void *);
+				base = 16;
+				alt = true;
+				sign = 0;
+				break;
+			case 'c':
+				*--str = va_arg(args,int);
+				pad = ' ';
+				break;
+			// String in RAM (%s) or in flash (%S), up to precision characters
+			case 's':
+			case 'S':
+			{
+				const char	*arg = va_arg(args,const char *);
+				bool		flash = *fmt == 'S';
+				size_t		len, i;
+
+				if(arg == NULL)
+				{
+					arg = "(null)";
+					flash = false;
+				}
+				for(len=0;(precision < 0 || len < (size_t)precision) && (flash ? pgm_read_byte(&arg[len]) : arg[len]);++len)
+					;
+				if(!left)
+					fioPad(&sink,' ',len > 255 ? 255 : len,width);
+				for(i=0;i<len;++i)
+					fioPut(&sink,flash ? pgm_read_byte(&arg[i]) : arg[i]);
+				if(left)
+					fioPad(&sink,' ',len > 255 ? 255 : len,width);
+				++fmt;
+				continue;
+			}
+			case 'e':
+			case 'E':
+			case 'f':
+			case 'F':
+			case 'g':
+			case 'G':
+				(void)va_arg(args,double);
+				*--str = '?';
+				pad = ' ';
+				break;
+			case '%':
+				*--str = '%';
+				pad = ' ';
+				break;
+			// End of the string in the middle of a conversion
+			case '\0':
+				continue;
+			// Unsupported conversion, output it as is. Skip an int sized
+			// argument, so the arguments after it still line up
+			default:
+				(void)va_arg(args,int);
+				*--str = *fmt;
+				*--str = '%';
+				pad = ' ';
+				break;
+		}
+
+		if(base)
+		{
+			// Zero with a precision of 0 has no digits
+			if(value || precision)
+				str = fioNumber(str,value,base,*fmt == 'X');
+			// The precision is the minimum number of digits and disables zero
+			// padding. Room is left for the sign and 0x
+			if(precision >= 0)
+			{
+				pad = ' ';
+				while(&buff[sizeof(buff)] - str < precision && str > &buff[3])
+					*--str = '0';
+			}
+			if(alt && base == 8 && *str != '0')
+				*--str = '0';
+			else if(alt && base == 16 && (value || *fmt == 'p'))
+			{
+				*--str = *fmt == 'X' ? 'X' : 'x';
+				*--str = '0';
+				prefix = 2;
+			}
+			if(sign)
+			{
+				*--str = sign;
+				++prefix;
+			}
+		}
+		fioPutPadded(&sink,str,&buff[sizeof(buff)] - str,prefix,width,left,pad);
+		++fmt;
+	}
+
+	// Add the text to the queue and start the device sending it
+	if(sink.que != NULL)
+	{
+		fioCommit(&sink);
+		if(buffers->start != NULL)
+			buffers->start(file,sink.dropped);
+	}
+
+	return(sink.count);
+}
@@ -29,6 +29,9 @@
 typedef struct
 {
 	volatile queue_t		*input, *output;
+	// Called after fioPrintf() writes the output queue directly, to start the
+	// device sending. dropped is the number of bytes that didn't fit
+	void					(*start)(FILE *file, uint16_t dropped);
 }fioBuffers_t;
 
 // Macros ----------------------------------------------------------------------
@@ -50,6 +53,15 @@ static inline void fioWaitInput(FILE *file)
 	} // End of critical section
 }
 
+// Wait until the file input buffer is not empty, or for up to the given number
+// of ticks. Use evntWaitTimedOut() to find out which happened
+static inline void fioWaitInputTimeout(FILE *file, uint32_t ticks)
+{
+	fioBuffers_t *buffer = (fioBuffers_t *)(file->buf);
+
+	evntWaitTimeout(queGetEvent(buffer->input), QUE_EVENT_NOT_EMPTY, ticks);
+}
+
 // Wait until the file output buffer is empty
 static inline void fioWaitOutput(FILE *file)
 {
@@ -63,6 +75,50 @@ static inline void fioWaitOutput(FILE *file)
 	} // End of critical section
 }
 
+// Wait until the file input buffer holds at least count bytes. Doesn't wait
+// if it already does. Borrows the input queue's high watermark until then
+static inline void fioWaitInputLevel(FILE *file, uint16_t count)
+{
+	fioBuffers_t *buffer = (fioBuffers_t *)(file->buf);
+	volatile queue_t *que = buffer->input;
+
+	// Start critical section of code
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if(queGetSize(que) < count)
+		{
+			queArmAbove(que, count);
+			evntEnable(queGetEvent(que), QUE_EVENT_ABOVE_N, fsmReady, fsmGetCurrentStateMachine());
+			fsmWait(fsmGetCurrentStateMachine());
+		}
+	} // End of critical section
+}
+
+// Wait until the file output buffer has room for count bytes. Doesn't wait
+// if it already does. Borrows the output queue's low watermark until then
+static inline void fioWaitOutputSpace(FILE *file, uint16_t count)
+{
+	fioBuffers_t *buffer = (fioBuffers_t *)(file->buf);
+	volatile queue_t *que = buffer->output;
+	uint16_t capacity = que->descr->capacity;
+
+	if(count > capacity)
+		count = capacity;
+
+	// Start critical section of code
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if(capacity - queGetSize(que) < count)
+		{
+			// Room for the whole capacity is the same as empty
+			if(count < capacity)
+				queArmBelow(que, capacity - count);
+			evntEnable(queGetEvent(que), QUE_EVENT_BELOW_N|QUE_EVENT_EMPTY, fsmReady, fsmGetCurrentStateMachine());
+			fsmWait(fsmGetCurrentStateMachine());
+		}
+	} // End of critical section
+}
+
 static inline void fioBusyWaitInput(FILE *file)
 {
 	fioBuffers_t *buffer = (fioBuffers_t *)(file->buf);
@@ -77,4 +133,16 @@ static inline void fioBusyWaitOutput(FILE *file)
 	while(queIsEmpty(buffer->output) == false);
 }
 
+// Formatted output ------------------------------------------------------------
+int fioPrintf(FILE *file, const char *fmt, ...);
+int fioVPrintf(FILE *file, const char *fmt, va_list args);
+
+// Send printf() and fprintf() through fioPrintf() in every file that includes
+// avrOS.h, including the application. fioPrintf() has no floating point
+// conversions, so this is off unless FIO_PRINTF is defined in avrOSConfig.h
+#ifdef FIO_PRINTF
+#define printf(...)		fioPrintf(stdout, __VA_ARGS__)
+#define fprintf			fioPrintf
+#endif
+
 #endif  // __FIO_H
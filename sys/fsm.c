@@ -31,15 +31,42 @@ extern void *__start_FSM_TABLE,*__stop_FSM_TABLE;
 // Internal Globals -----------------------------------------------------------
 static uint32_t scanCycle = 0;
 volatile static fsmStateMachine_t   *currStateMachine = NULL, *Ready = NULL, *Wait = NULL, *Stopped = NULL; 
+// Tick waits sorted by expiry tick, the earliest at the head
+volatile static fsmStateMachine_t   *Delay = NULL, *DelayTail = NULL;
 static char initString[] = {"Init"};
 
+// Ready list priority bitmap. Each set bit marks a priority level with at
+// least one ready state machine. The levels are grouped by fsmType_t band
+// (priority bits 7:6), group within the band (bits 5:3) and level within the
+// group (bits 2:0) so every search is three 8 bit lookups
+static uint8_t fsmRdyBand = 0, fsmRdyGrp[4], fsmRdyTbl[32];
+// Tail of each priority level FIFO within the Ready list
+volatile static fsmStateMachine_t	*fsmRdyTail[256];
+// Bit mask and most significant bit lookup tables
+static const uint8_t fsmBit[8] = {0x01,0x02,0x04,0x08,0x10,0x20,0x40,0x80};
+static const uint8_t fsmMsbTbl[16] = {0,0,1,1,2,2,2,2,3,3,3,3,3,3,3,3};
+
+#ifdef FSM_PROF
+// Profiled states, assigned on the first call to each state
+static fsmProfState_t	fsmProfStates[FSM_PROF_STATES];
+static uint8_t			fsmProfStateCount = 0;
+#endif
+
 // Internal functions ---------------------------------------------------------
 volatile static fsmStateMachine_t* fsmGetStateMachine(const char *name);
-static int fsmLstAdd(volatile fsmStateMachine_t **list, volatile fsmStateMachine_t *sm);
-static int fsmLstRemove(volatile fsmStateMachine_t **list, volatile fsmStateMachine_t *sm);
-static bool fsmListFind(volatile fsmStateMachine_t *list, volatile fsmStateMachine_t *sm);
+static void fsmLstAdd(volatile fsmStateMachine_t **list, volatile fsmStateMachine_t *sm, fsmRunState_t runState);
+static void fsmLstRemove(volatile fsmStateMachine_t **list, volatile fsmStateMachine_t *sm);
+static void fsmRdyAdd(volatile fsmStateMachine_t *sm);
+static void fsmRdyRemove(volatile fsmStateMachine_t *sm);
+static void fsmDlyAdd(volatile fsmStateMachine_t *sm);
+static void fsmDlyRemove(volatile fsmStateMachine_t *sm);
+static int fsmMove(volatile fsmStateMachine_t *sm, fsmRunState_t runState);
 static void fsmLstPrint(FILE *file, volatile fsmStateMachine_t *list);
 static void initTablePrint(FILE *file);
+#ifdef FSM_PROF
+static fsmProfState_t *fsmProfGetState(volatile fsmStateMachine_t *sm);
+static void fsmProfUpdate(volatile fsmStateMachine_t *sm, uint32_t cycles);
+#endif
 
 // CLI Commands ---------------------------------------------------------------
 #ifdef FSM_CLI
@@ -57,6 +84,8 @@ static int fsmCmd(int argc, char *argv[])
 		fsmLstPrint(stdout, Ready);
 		printf(BOLD UNDERLINE FG_BLUE "Wait Queue:\n\r" RESET);
 		fsmLstPrint(stdout, Wait);
+		printf(BOLD UNDERLINE FG_BLUE "Delay Queue:\n\r" RESET);
+		fsmLstPrint(stdout, Delay);
 		printf(BOLD UNDERLINE FG_BLUE "Stopped Queue:\n\r" RESET);
 		fsmLstPrint(stdout, Stopped);
 	}
@@ -72,13 +101,13 @@ static int fsmCmd(int argc, char *argv[])
 			printf("Prev State: %-20s Curr State: %-20s Next State: %-20s\n\r",	stateMachine->prevStateName,
 																				stateMachine->currStateName,
 																				stateMachine->nextStateName);
-			printf("Initial State: %s Ticks: %7lu\n\r",stateMachine->initialCall==true?"Yes":"No",stateMachine->ticks);
+			printf("Initial State: %s Ticks: %7lu\n\r",stateMachine->initialCall==true?"Yes":"No",fsmGetWaitTicks(stateMachine));
 			printf("Run State: ");
-			if(fsmListFind(Ready,stateMachine) == true)
+			if(stateMachine->runState == FSM_RUN_READY)
 				printf("Ready");
-			else if(fsmListFind(Wait,stateMachine) == true)
+			else if(stateMachine->runState == FSM_RUN_WAIT || stateMachine->runState == FSM_RUN_DELAY)
 				printf("Waiting");
-			else if(fsmListFind(Stopped,stateMachine) == true)
+			else if(stateMachine->runState == FSM_RUN_STOPPED)
 				printf("Stopped");
 			printf("\n\r");
 		}
@@ -133,120 +162,308 @@ static int fsmResetCmd(int argc, char *argv[])
   }
   return(-1);
 }
-#endif // FSM_CLI
 
-// Internal Functions ----------------------------------------------------------
-static int fsmLstAdd(volatile fsmStateMachine_t **list, volatile fsmStateMachine_t *sm)
+#ifdef FSM_PROF
+// Print a profile row. Total time is in ms, the average and max in cycles
+static void fsmProfPrint(FILE *file, const char *name, fsmProf_t *prof)
 {
-	int ret = 0;
-	
-	// If sm is valid...
-	if(sm != NULL)
+	uint32_t	cpuFreq = cpuGetFrequency();
+
+	fprintf(file,"\t%-20s%10lu%10lu%10lu%10lu", name!=NULL?name:"<none>",
+											prof->calls,
+											cpuFreq?(uint32_t)(prof->cycles/cpuFreq):0,
+											prof->calls?(uint32_t)(prof->cycles/prof->calls):0,
+											prof->maxCycles);
+}
+
+ADD_COMMAND("fsmProf",fsmProfCmd);
+static int fsmProfCmd(int argc, char *argv[])
+{
+	if(argc == 1)
 	{
-		volatile fsmStateMachine_t *curr = *list, *prev = NULL;
-		// If there is no elements in the current list...
-		if(*list == NULL)
-		{
-			*list = sm;
-			sm->next = NULL;
-		}
-		// Else there is at least one element in the current list...
-		else
-		{
-			// While this is not the end of the list...
-			while(curr!=NULL)
+		fsmProf_t	prof;
+		const char	*maxState;
+
+		printf(BOLD UNDERLINE FG_BLUE "State Machines:          Calls Total(ms)  Avg(cyc)  Max(cyc) Max State\n\r" RESET);
+		fsmStateMachineDescr_t *descr = (fsmStateMachineDescr_t *)&__start_FSM_TABLE;
+		for(; descr < (fsmStateMachineDescr_t *)&__stop_FSM_TABLE; ++descr)
+			if(descr->stateMachine != NULL)
 			{
-				// If this element is lower priority than the new element...
-				if(sm->stateMachineDescr->priority < curr->stateMachineDescr->priority)
+				// Copy the profile so the counts are consistent
+				ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 				{
-					// If not the head element...
-					if(prev)
-					{
-						sm->next = prev->next;
-						prev->next = sm;
-						break;
-					}
-					// Else head element...
-					else
-					{
-						sm->next = curr;
-						*list = sm;
-						break;
-					}
+					prof = descr->stateMachine->prof;
+					maxState = descr->stateMachine->profMaxState;
 				}
-				// Step to the next element in the list
-				prev = curr;
-				curr = curr->next;
+				fsmProfPrint(stdout,descr->name,&prof);
+				printf(" %s\n\r",maxState!=NULL?maxState:"");
 			}
-			// If reached the end of the list...
-			if(curr == NULL)
+
+		printf(BOLD UNDERLINE FG_BLUE "States:                  Calls Total(ms)  Avg(cyc)  Max(cyc) State Machine\n\r" RESET);
+		for(uint8_t i=0;i<fsmProfStateCount;++i)
+		{
+			ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 			{
-				prev->next = sm;
-				sm->next = NULL;
+				prof = fsmProfStates[i].prof;
 			}
+			fsmProfPrint(stdout,fsmProfStates[i].name,&prof);
+			printf(" %s\n\r",fsmProfStates[i].stateMachine->stateMachineDescr->name);
 		}
+		if(fsmProfStateCount == FSM_PROF_STATES)
+			printf("\tState table full, increase FSM_PROF_STATES\n\r");
 	}
-	// Else sm is not valid...
+	else if((argc == 2) && (argv[1] != NULL) && strcmp(argv[1],"reset") == 0)
+		fsmProfReset();
 	else
-		ret = -1;
-	
-	return(ret);
+		return(-1);
+
+	return(0);
 }
+#endif // FSM_PROF
+#endif // FSM_CLI
 
-static int fsmLstRemove(volatile fsmStateMachine_t **list, volatile fsmStateMachine_t *sm)
+// Internal Functions ----------------------------------------------------------
+// Return the most significant set bit of a non-zero byte
+static inline uint8_t fsmMsb(uint8_t bits)
 {
-	int ret = 0;
-	
-	// If the state machine is valid...
-	if(sm != NULL)
+	return(bits&0xf0 ? 4+fsmMsbTbl[bits>>4] : fsmMsbTbl[bits]);
+}
+
+// Return the tail of the nearest higher priority (lower value) level that has
+// ready state machines, or NULL if there are none
+static volatile fsmStateMachine_t *fsmRdyPrevTail(fsmPriority_t priority)
+{
+	uint8_t band = priority>>6, grp = (priority>>3)&0x07, bits;
+
+	// If there is a higher priority level in the same group...
+	if((bits = fsmRdyTbl[priority>>3]&(fsmBit[priority&0x07]-1)))
+		return(fsmRdyTail[(priority&0xf8)|fsmMsb(bits)]);
+
+	// If there is a higher priority group in the same band...
+	if((bits = fsmRdyGrp[band]&(fsmBit[grp]-1)))
+		grp = fsmMsb(bits);
+	// Else if there is a higher priority band...
+	else if((bits = fsmRdyBand&(fsmBit[band]-1)))
 	{
-		volatile fsmStateMachine_t *curr = *list, *prev = NULL;
-		// Until the end of the list
-		while(curr)
+		band = fsmMsb(bits);
+		grp = fsmMsb(fsmRdyGrp[band]);
+	}
+	// Else there is nothing ahead of this priority
+	else
+		return(NULL);
+
+	return(fsmRdyTail[(band<<6)|(grp<<3)|fsmMsb(fsmRdyTbl[(band<<3)|grp])]);
+}
+
+// Link the state machine to the head of an unordered list
+static void fsmLstAdd(volatile fsmStateMachine_t **list, volatile fsmStateMachine_t *sm, fsmRunState_t runState)
+{
+	sm->prev = NULL;
+	sm->next = *list;
+	if(*list != NULL)
+		(*list)->prev = sm;
+	*list = sm;
+	sm->runState = runState;
+}
+
+// Unlink the state machine from the list it is in
+static void fsmLstRemove(volatile fsmStateMachine_t **list, volatile fsmStateMachine_t *sm)
+{
+	// If this is not the head...
+	if(sm->prev != NULL)
+		sm->prev->next = sm->next;
+	// Else this is the head...
+	else
+		*list = sm->next;
+	if(sm->next != NULL)
+		sm->next->prev = sm->prev;
+
+	sm->next = sm->prev = NULL;
+	sm->runState = FSM_RUN_NONE;
+}
+
+// Link the state machine to the tail of its priority level in the Ready list
+static void fsmRdyAdd(volatile fsmStateMachine_t *sm)
+{
+	fsmPriority_t priority = sm->stateMachineDescr->priority;
+	volatile fsmStateMachine_t *tail = fsmRdyTail[priority];
+
+	// If this level is empty, insert behind the nearest higher priority level
+	// and mark the level as ready
+	if(tail == NULL)
+	{
+		tail = fsmRdyPrevTail(priority);
+		fsmRdyTbl[priority>>3] |= fsmBit[priority&0x07];
+		fsmRdyGrp[priority>>6] |= fsmBit[(priority>>3)&0x07];
+		fsmRdyBand |= fsmBit[priority>>6];
+	}
+
+	// If there is a state machine ahead of this one...
+	if(tail != NULL)
+	{
+		sm->prev = tail;
+		sm->next = tail->next;
+		tail->next = sm;
+	}
+	// Else this is the new head of the Ready list...
+	else
+	{
+		sm->prev = NULL;
+		sm->next = Ready;
+		Ready = sm;
+	}
+	if(sm->next != NULL)
+		sm->next->prev = sm;
+
+	fsmRdyTail[priority] = sm;
+	sm->runState = FSM_RUN_READY;
+}
+
+// Unlink the state machine from the Ready list
+static void fsmRdyRemove(volatile fsmStateMachine_t *sm)
+{
+	fsmPriority_t priority = sm->stateMachineDescr->priority;
+
+	// If this is the tail of its priority level...
+	if(fsmRdyTail[priority] == sm)
+	{
+		// If the level has another state machine, it becomes the tail
+		if(sm->prev != NULL && sm->prev->stateMachineDescr->priority == priority)
+			fsmRdyTail[priority] = sm->prev;
+		// Else the level is now empty
+		else
 		{
-			// If this is the element to remove...
-			if(curr == sm)
-			{
-				// If this is not the head...
-				if(prev != NULL)
-				{
-					prev->next = curr->next;
-					break;
-				}
-				// Else this is the head...
-				else
-				{
-					*list = curr->next;
-					break;
-				}
-				curr->next = NULL;
-			}
-				
-			// Step to the next element
-			prev = curr;
-			curr = curr->next;
+			fsmRdyTail[priority] = NULL;
+			if(!(fsmRdyTbl[priority>>3] &= ~fsmBit[priority&0x07]))
+				if(!(fsmRdyGrp[priority>>6] &= ~fsmBit[(priority>>3)&0x07]))
+					fsmRdyBand &= ~fsmBit[priority>>6];
 		}
-		// If reached the end of the list without finding the element...
-		if(curr == NULL)
-			ret = -1;
 	}
-	// Else the state machine is not valid...
+
+	fsmLstRemove(&Ready,sm);
+}
+
+// Link the state machine into the Delay list in expiry order. The list is
+// searched from the tail since periodic waits usually expire last
+static void fsmDlyAdd(volatile fsmStateMachine_t *sm)
+{
+	volatile fsmStateMachine_t *curr = DelayTail;
+
+	// Step back to the last wait that expires at or before this one
+	while(curr != NULL && (int32_t)(curr->ticks - sm->ticks) > 0)
+		curr = curr->prev;
+
+	// If there is a wait that expires first...
+	if(curr != NULL)
+	{
+		sm->prev = curr;
+		sm->next = curr->next;
+		curr->next = sm;
+	}
+	// Else this is the new head of the Delay list...
 	else
-		ret = false;
-		
-	return(ret);
+	{
+		sm->prev = NULL;
+		sm->next = Delay;
+		Delay = sm;
+	}
+	if(sm->next != NULL)
+		sm->next->prev = sm;
+	else
+		DelayTail = sm;
+
+	sm->runState = FSM_RUN_DELAY;
+}
+
+// Unlink the state machine from the Delay list
+static void fsmDlyRemove(volatile fsmStateMachine_t *sm)
+{
+	if(DelayTail == sm)
+		DelayTail = sm->prev;
+
+	fsmLstRemove(&Delay,sm);
 }
 
-static bool fsmListFind(volatile fsmStateMachine_t *list, volatile fsmStateMachine_t *stateMachine)
+// Move the state machine to the list for the given run state
+static int fsmMove(volatile fsmStateMachine_t *sm, fsmRunState_t runState)
 {
-	while(list)
+	// If an event wait with timeout is in progress, it's over. Stop waiting on
+	// the event
+	if(sm->waitEvent != NULL)
 	{
-		if(list == stateMachine)
-			return(true);
-		list = list->next;
+		evntUnsubscribe(sm->waitEvent,NULL,sm);
+		sm->waitEvent = NULL;
 	}
-	return(false);
+
+	// Unlink from the current list
+	if(sm->runState == FSM_RUN_READY)
+		fsmRdyRemove(sm);
+	else if(sm->runState == FSM_RUN_WAIT)
+		fsmLstRemove(&Wait,sm);
+	else if(sm->runState == FSM_RUN_DELAY)
+		fsmDlyRemove(sm);
+	else if(sm->runState == FSM_RUN_STOPPED)
+		fsmLstRemove(&Stopped,sm);
+
+	// Link to the new list
+	if(runState == FSM_RUN_READY)
+		fsmRdyAdd(sm);
+	else if(runState == FSM_RUN_WAIT)
+		fsmLstAdd(&Wait,sm,FSM_RUN_WAIT);
+	else if(runState == FSM_RUN_DELAY)
+		fsmDlyAdd(sm);
+	else if(runState == FSM_RUN_STOPPED)
+		fsmLstAdd(&Stopped,sm,FSM_RUN_STOPPED);
+
+	return(0);
+}
+
+#ifdef FSM_PROF
+// Find the profile of the state machine's current state. Assign a row in the
+// state profile table on the first call to the state
+static fsmProfState_t *fsmProfGetState(volatile fsmStateMachine_t *sm)
+{
+	uint8_t i;
+
+	for(i=0;i<fsmProfStateCount;++i)
+		if(fsmProfStates[i].state == sm->currState && fsmProfStates[i].stateMachine == sm)
+			return(&fsmProfStates[i]);
+
+	// If the table is full, the state isn't profiled
+	if(fsmProfStateCount == FSM_PROF_STATES)
+		return(NULL);
+
+	fsmProfStates[i].state = sm->currState;
+	fsmProfStates[i].name = sm->currStateName;
+	fsmProfStates[i].stateMachine = sm;
+	++fsmProfStateCount;
+
+	return(&fsmProfStates[i]);
 }
+
+// Add a state handler call to the profiles
+static void fsmProfUpdate(volatile fsmStateMachine_t *sm, uint32_t cycles)
+{
+	++sm->prof.calls;
+	sm->prof.cycles += cycles;
+	if(cycles > sm->prof.maxCycles)
+	{
+		sm->prof.maxCycles = cycles;
+		sm->profMaxState = sm->currStateName;
+	}
+
+	if(sm->profState != NULL)
+	{
+		fsmProf_t *prof = &sm->profState->prof;
+
+		++prof->calls;
+		prof->cycles += cycles;
+		if(cycles > prof->maxCycles)
+			prof->maxCycles = cycles;
+	}
+}
+#endif // FSM_PROF
+
 static void fsmLstPrint(FILE *file, volatile fsmStateMachine_t *list)
 {
 	volatile fsmStateMachine_t *curr = list;
@@ -257,7 +474,7 @@ static void fsmLstPrint(FILE *file, volatile fsmStateMachine_t *list)
 		while(curr)
 		{
 			fprintf(file, "\t%-20s", curr->stateMachineDescr->name);
-			fprintf(file, "Priority:%4d Ticks:%6lu\n\r", curr->stateMachineDescr->priority,curr->ticks);
+			fprintf(file, "Priority:%4d Ticks:%6lu\n\r", curr->stateMachineDescr->priority,fsmGetWaitTicks(curr));
 			curr = curr->next;
 		}
 }
@@ -302,7 +519,7 @@ void fsmInit()
 			if(stateMachine != NULL)
 			{
 				// Add the state machine to the ready list in priority order
-				fsmLstAdd(&Ready,stateMachine);
+				fsmRdyAdd(stateMachine);
 			}
 			// Else this is an initializer
 			else
@@ -415,15 +632,13 @@ int fsmSetNextStateVerbose(volatile fsmStateMachine_t *stateMachine,
 // Stop the given state machine
 int fsmStop(volatile fsmStateMachine_t *stateMachine)
 {
-	int ret;
+	int ret = -1;
 	
 	// Start critical section of code
 	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 	{
-		if(!(ret = fsmLstRemove(&Ready,stateMachine)))
-			fsmLstAdd(&Stopped,stateMachine);
-		else if(!(ret = fsmLstRemove(&Wait,stateMachine)))
-			fsmLstAdd(&Stopped,stateMachine);
+		if(stateMachine != NULL && (stateMachine->runState == FSM_RUN_READY || stateMachine->runState == FSM_RUN_WAIT || stateMachine->runState == FSM_RUN_DELAY))
+			ret = fsmMove(stateMachine,FSM_RUN_STOPPED);
 	} // End critical section
 		
 	return(ret);
@@ -432,13 +647,13 @@ int fsmStop(volatile fsmStateMachine_t *stateMachine)
 // Put the given state machine on the wait list
 int fsmWait(volatile fsmStateMachine_t *stateMachine)
 {
-	int ret;
+	int ret = -1;
 	
 	// Start critical section of code
 	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 	{
-		if(!(ret = fsmLstRemove(&Ready,stateMachine)))
-			fsmLstAdd(&Wait,stateMachine);
+		if(stateMachine != NULL && stateMachine->runState == FSM_RUN_READY)
+			ret = fsmMove(stateMachine,FSM_RUN_WAIT);
 	} // End critical section
 	
 	return(ret);
@@ -447,48 +662,95 @@ int fsmWait(volatile fsmStateMachine_t *stateMachine)
 // Put the given state machine on the ready list
 int fsmReady(volatile fsmStateMachine_t *stateMachine)
 {
-	int ret;
+	int ret = -1;
 	
 	// Start critical section of code
 	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 	{
-		if(!(ret = fsmLstRemove(&Wait,stateMachine)))
-			fsmLstAdd(&Ready,stateMachine);
-		else if(!(ret = fsmLstRemove(&Stopped,stateMachine)))
-			fsmLstAdd(&Ready,stateMachine);
-		else
-			ret = -1;
+		if(stateMachine != NULL && (stateMachine->runState == FSM_RUN_WAIT || stateMachine->runState == FSM_RUN_DELAY || stateMachine->runState == FSM_RUN_STOPPED))
+			ret = fsmMove(stateMachine,FSM_RUN_READY);
 	} // End critical section
 	
 	return(ret);
 }
 
-// Update the tick counters of the state machines in the Wait queue
+// Move the state machines with expired tick waits to the Ready queue
 void fsmUpdateWaitTicks()
 {
-	volatile fsmStateMachine_t *smCurrent = Wait;
+	// Start critical section of code
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		uint32_t tick = sysGetTickCount();
+
+		// Only the expired waits at the head of the Delay list are touched
+		while(Delay != NULL && (int32_t)(tick - Delay->ticks) >= 0)
+		{
+			// If waiting on an event with a timeout, the timeout won
+			if(Delay->waitEvent != NULL)
+				Delay->timedOut = true;
+			fsmMove(Delay,FSM_RUN_READY);
+		}
+	}
+}
+
+// Has the earliest tick wait expired at the given tick count?
+bool fsmWaitTicksExpired(uint32_t tick)
+{
+	return(Delay != NULL && (int32_t)(tick - Delay->ticks) >= 0);
+}
+
+// Get the earliest tick wait expiry
+bool fsmGetNextWaitTick(uint32_t *tick)
+{
+	bool ret = false;
 
 	// Start critical section of code
 	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 	{
-		while(smCurrent)
+		if(Delay != NULL)
 		{
-			if(smCurrent->ticks)
-			{
-				--smCurrent->ticks;
-				if(!smCurrent->ticks)
-					fsmReady(smCurrent);
-			}
-			smCurrent = smCurrent->next;
+			*tick = Delay->ticks;
+			ret = true;
 		}
 	}
+
+	return(ret);
+}
+
+// Get the remaining ticks of the state machine's tick wait
+uint32_t fsmGetWaitTicks(volatile fsmStateMachine_t *stateMachine)
+{
+	uint32_t ret = 0;
+
+	// Start critical section of code
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if(stateMachine->runState == FSM_RUN_DELAY && (int32_t)(stateMachine->ticks - sysGetTickCount()) > 0)
+			ret = stateMachine->ticks - sysGetTickCount();
+	}
+
+	return(ret);
 }
 
 // Set the state machine to sit in the wait queue for x ticks
 void fsmWaitTicks(volatile fsmStateMachine_t*stateMachine, uint32_t ticks)
 {
-	stateMachine->ticks = ticks;
-	fsmWait(stateMachine);
+	// Start critical section of code
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		// If no ticks, wait without a timeout
+		if(ticks == 0)
+		{
+			if(stateMachine->runState == FSM_RUN_READY || stateMachine->runState == FSM_RUN_DELAY)
+				fsmMove(stateMachine,FSM_RUN_WAIT);
+		}
+		// Else if ready or already waiting, wait until the expiry tick
+		else if(stateMachine->runState == FSM_RUN_READY || stateMachine->runState == FSM_RUN_WAIT || stateMachine->runState == FSM_RUN_DELAY)
+		{
+			stateMachine->ticks = sysGetTickCount()+ticks;
+			fsmMove(stateMachine,FSM_RUN_DELAY);
+		}
+	} // End critical section
 }
 
 // Set the state machine to sit in the wait queue for x milliseconds
@@ -526,23 +788,62 @@ void fsmDispatch(void)
 				currStateMachine->prevStateName = currStateMachine->currStateName;
 				currStateMachine->currStateName = currStateMachine->nextStateName;
 				currStateMachine->nextStateName = NULL;
+#ifdef FSM_PROF
+				currStateMachine->profState = NULL;
+#endif
 			}
 
 			// If the current state is valid..
 			if(currStateMachine->currState != NULL)
 			{
+				TRACE(TRC_FSM_ENTER,0,currStateMachine,currStateMachine->currStateName);
+				CRASH_STATE(currStateMachine);
+#ifdef FSM_PROF
+				// If the current state's profile hasn't been found, find it
+				if(currStateMachine->profState == NULL)
+					currStateMachine->profState = fsmProfGetState(currStateMachine);
+
+				uint32_t start = sysGetCycles();
+#endif
 				// Call the current state machine's state handler
 				currStateMachine->currState(currStateMachine);
+#ifdef FSM_PROF
+				fsmProfUpdate(currStateMachine,sysGetCycles()-start);
+#endif
+				TRACE(TRC_FSM_EXIT,0,currStateMachine,currStateMachine->currStateName);
 				currStateMachine->initialCall = false;
 			}
 			
 			// Assign the next state machine in the Ready list
 			currStateMachine = nextStateMachine;
  
-     	    // If an event has occurred...
-  	        if(evntDispatch())
+     	    // If an event has occurred or the next state machine left the
+     	    // Ready list...
+  	        if(evntDispatch() || (currStateMachine != NULL && currStateMachine->runState != FSM_RUN_READY))
   	            // Reset to the highest priority task
 				currStateMachine = Ready;
 		}
 	}
 }
+
+#ifdef FSM_PROF
+// Reset the state machine and state profiles
+void fsmProfReset(void)
+{
+	// Start critical section of code
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		fsmStateMachineDescr_t *descr = (fsmStateMachineDescr_t *)&__start_FSM_TABLE;
+		for(; descr < (fsmStateMachineDescr_t *)&__stop_FSM_TABLE; ++descr)
+			if(descr->stateMachine != NULL)
+			{
+				memset((void *)&descr->stateMachine->prof,0,sizeof(fsmProf_t));
+				descr->stateMachine->profMaxState = NULL;
+				descr->stateMachine->profState = NULL;
+			}
+
+		memset(fsmProfStates,0,sizeof(fsmProfStates));
+		fsmProfStateCount = 0;
+	} // End critical section
+}
+#endif
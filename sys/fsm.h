@@ -45,9 +45,41 @@ typedef enum FSM_TYPE
  */
 typedef uint8_t fsmPriority_t;
 
-// Forward declare the STATE_MACHINE and STATE_DESCR structures
+/**----------------------------------------------------------------------------
+ * State machine run state
+ *
+ * Identifies the scheduler list the state machine is currently linked into
+ */
+typedef enum FSM_RUN_STATE
+{
+	FSM_RUN_NONE = 0,	///< Not linked into a scheduler list
+	FSM_RUN_READY,		///< Linked into the Ready list
+	FSM_RUN_WAIT,		///< Linked into the Wait list
+	FSM_RUN_DELAY,		///< Linked into the Delay list (waiting on the system tick)
+	FSM_RUN_STOPPED		///< Linked into the Stopped list
+}fsmRunState_t;
+
+// Forward declare the STATE_MACHINE, STATE_DESCR and EVENT structures
 struct STATE_MACHINE_TYPE;
 struct STATE_MACHINE_DESCR_TYPE;
+struct EVENT_TYPE;
+
+#ifdef FSM_PROF
+#ifndef FSM_PROF_STATES
+#define FSM_PROF_STATES	32	///< Number of states that can be profiled
+#endif
+/**----------------------------------------------------------------------------
+ * Profile type
+ *
+ * CPU time spent in state handler calls, measured in CPU cycles
+ */
+typedef struct FSM_PROF_TYPE
+{
+	uint32_t	calls;			///< Number of state handler calls
+	uint64_t	cycles;			///< Total cycles spent in the state handler calls
+	uint32_t	maxCycles;		///< Longest state handler call
+} fsmProf_t;
+#endif
 
 /**----------------------------------------------------------------------------
  * State handler function pointer type
@@ -75,11 +107,37 @@ typedef struct STATE_MACHINE_TYPE
 	fsmHandler_t							prevState;			///< Previous state function pointer
 	fsmHandler_t							currState;			///< Current state function pointer
 	fsmHandler_t							nextState;			///< Next state function pointer
-	uint32_t								ticks;				///< Tick count for system tick wait
+	uint32_t								ticks;				///< System tick count the tick wait expires on
+	fsmRunState_t							runState;			///< Scheduler list the state machine is linked into
 	volatile struct STATE_MACHINE_TYPE    	*next;				///< Next pointer used for the SM queues
+	volatile struct STATE_MACHINE_TYPE    	*prev;				///< Previous pointer used for the SM queues
+	volatile struct EVENT_TYPE				*waitEvent;			///< Event of an evntWaitTimeout() in progress
+	bool									timedOut;			///< The last evntWaitTimeout() timed out
+	uint8_t									logLevel;			///< Runtime log level, up to LOG_LEVEL
 	const struct STATE_MACHINE_DESCR_TYPE 	*stateMachineDescr;	///< Pointer to the state machine descriptor
+#ifdef FSM_PROF
+	fsmProf_t								prof;				///< Profile of all the state machine's states
+	const char								*profMaxState;		///< Name of the state with the longest call
+	struct FSM_PROF_STATE_TYPE				*profState;			///< Profile of the current state
+#endif
 } fsmStateMachine_t;
 
+#ifdef FSM_PROF
+/**----------------------------------------------------------------------------
+ * State profile type
+ *
+ * Row in the table of profiled states. A row is assigned to each state
+ * (function) of each state machine the first time it is called
+ */
+typedef struct FSM_PROF_STATE_TYPE
+{
+	fsmHandler_t					state;			///< State function pointer
+	const char						*name;			///< Name of the state
+	volatile fsmStateMachine_t		*stateMachine;	///< State machine the state belongs to
+	fsmProf_t						prof;			///< Profile of the state
+} fsmProfState_t;
+#endif
+
 /**
  * State machine descriptor type
  * 
@@ -109,7 +167,7 @@ typedef struct STATE_MACHINE_DESCR_TYPE
 #define ADD_STATE_MACHINE(stateMachineName, smInitHandler, smPriority, ...)	\
 		int smInitHandler(volatile fsmStateMachine_t *stateMachine); \
 		const static fsmStateMachineDescr_t SECTION(FSM_TABLE) CONCAT(stateMachineName,_descr); \
-		volatile fsmStateMachine_t stateMachineName = {.currStateName = NULL, .prevStateName = NULL, .nextStateName = NULL, .initialCall = false, .prevState = NULL, .currState = NULL, .nextState = smInitHandler, .ticks = 0, .next = NULL, .stateMachineDescr = &CONCAT(stateMachineName,_descr)}; \
+		volatile fsmStateMachine_t stateMachineName = {.currStateName = NULL, .prevStateName = NULL, .nextStateName = NULL, .initialCall = false, .prevState = NULL, .currState = NULL, .nextState = smInitHandler, .ticks = 0, .runState = FSM_RUN_NONE, .next = NULL, .prev = NULL, .waitEvent = NULL, .timedOut = false, .logLevel = LOG_LEVEL, .stateMachineDescr = &CONCAT(stateMachineName,_descr)}; \
 		const static fsmStateMachineDescr_t SECTION(FSM_TABLE) CONCAT(stateMachineName,_descr) = { .name = #stateMachineName, .stateMachine = &stateMachineName, .handler.fsmHandler = smInitHandler, .priority = smPriority, .instance = DEFAULT_OR_ARG(,##__VA_ARGS__,__VA_ARGS__,NULL)};
 /**
  * Add an initializer to the application
@@ -272,8 +330,32 @@ int	fsmStop(volatile fsmStateMachine_t *stateMachine);	///< [in] Pointer to stat
 /**----------------------------------------------------------------------------
  * Update the state machines in the wait queue wating on the system timer
  * 
+ * Moves the state machines whose tick wait has expired to the ready queue.
+ * Only the expired state machines are touched
+ */
+void fsmUpdateWaitTicks();
+/**----------------------------------------------------------------------------
+ * Has the earliest tick wait expired?
+ *
+ * Returns true if the state machine at the head of the delay queue is due at
+ * the given system tick count. Called by the system tick interrupt to decide
+ * if the wait ticks need to be updated
+ */
+bool fsmWaitTicksExpired(uint32_t tick);					///< [in] Current system tick count
+/**----------------------------------------------------------------------------
+ * Get the earliest tick wait expiry
+ *
+ * Sets tick to the system tick count the earliest tick wait expires on.
+ * Returns false if no state machine is waiting on the system tick
+ */
+bool fsmGetNextWaitTick(uint32_t *tick);					///< [out] Expiry tick count
+/**----------------------------------------------------------------------------
+ * Get the remaining ticks of a tick wait
+ *
+ * Returns the number of system ticks until the given state machine's tick
+ * wait expires, or 0 if it is not waiting on the system tick
  */
-void fsmUpdateWaitTicks();								///< [in] Pointer to state machine
+uint32_t fsmGetWaitTicks(volatile fsmStateMachine_t *stateMachine);	///< [in] Pointer to state machine
 /**----------------------------------------------------------------------------
  * Set the state machine to sit in the wait queue for x ticks
  * 
@@ -294,5 +376,14 @@ void fsmWaitMilliseconds(volatile fsmStateMachine_t*stateMachine, uint16_t ms);
  * again. It will return once there are no state machines in the ready queue
  */
 void	fsmDispatch(void);
+#ifdef FSM_PROF
+/**----------------------------------------------------------------------------
+ * Reset the state machine and state profiles
+ *
+ * Clears the call counts and cycle counts of all the state machines and
+ * states, and releases the rows of the state profile table
+ */
+void	fsmProfReset(void);
+#endif
 
 #endif /* __FSM_H */
@@ -0,0 +1,139 @@
+/*
+ * message.c
+ *
+ * Functions to implement variable length message queues on top of the byte
+ * queue reserve/commit and peek/release functions. Any number of state
+ * machines or interrupts may send to a message queue. Only one may receive
+ *
+ * Copyright (C) 2021 by John Anderson <racerxr650r@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR
+ * IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../avrOS.h"
+
+// Internal functions ---------------------------------------------------------
+// Bytes a message of length bytes takes in the buffer
+static inline uint16_t msgRecordSize(uint16_t length)
+{
+	return(MSG_HEADER_SIZE + ((length+1) & ~1));
+}
+
+// External functions ---------------------------------------------------------
+// Copy a message of length bytes into the queue
+// Return: True if sent, false if there wasn't room for it or it's longer than
+// the queue can ever hold
+bool msgSend(volatile queue_t *que, const void *msg, uint16_t length)
+{
+	const queDescriptor_t	*descr = que->descr;
+	volatile msgStats_t		*stats = descr->msg;
+	uint16_t				size, span;
+	uint8_t					*record;
+	bool					ret = false;
+
+	// If the message can never fit, drop it. This also keeps the record size
+	// from wrapping and the length from being taken for MSG_PAD
+	if(length > descr->capacity - MSG_HEADER_SIZE)
+	{
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+			++stats->dropped;
+		return(false);
+	}
+	size = msgRecordSize(length);
+
+	// Start of critical section
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		span = queReserve(que,size,(void **)&record);
+
+		// If the message doesn't fit before the end of the buffer but does at
+		// the beginning...
+		if(span < size && record+span == descr->buffer+descr->capacity && descr->capacity-queGetSize(que)-span >= size)
+		{
+			// Pad out the end of the buffer and start at the beginning
+			*(uint16_t *)record = MSG_PAD;
+			queCommit(que,span);
+			span = queReserve(que,size,(void **)&record);
+		}
+
+		if(span >= size)
+		{
+			*(uint16_t *)record = length;
+			memcpy(record+MSG_HEADER_SIZE,msg,length);
+			queCommit(que,size);
+
+			if(++stats->count > stats->maxCount)
+				stats->maxCount = stats->count;
+			if(length > stats->maxLength)
+				stats->maxLength = length;
+			ret = true;
+		}
+		else
+		{
+			// End the reservation without adding anything
+			if(span)
+				queCommit(que,0);
+			++stats->dropped;
+		}
+	} // End of critical section
+	return(ret);
+}
+
+// Get the next message in place without removing it from the queue. Call
+// msgRelease() when done with it
+// Return: True if there is a message, *msg and *length set to it
+bool msgPeek(volatile queue_t *que, void **msg, uint16_t *length)
+{
+	uint8_t		*record;
+	uint16_t	span = quePeek(que,(void **)&record);
+
+	// If the next record pads out the end of the buffer, skip it
+	if(span && *(uint16_t *)record == MSG_PAD)
+	{
+		queRelease(que,span);
+		span = quePeek(que,(void **)&record);
+	}
+
+	if(!span)
+		return(false);
+
+	*length = *(uint16_t *)record;
+	*msg = record+MSG_HEADER_SIZE;
+	return(true);
+}
+
+// Remove the message returned by msgPeek() from the queue
+void msgRelease(volatile queue_t *que)
+{
+	uint8_t		*record;
+
+	if(quePeek(que,(void **)&record))
+	{
+		queRelease(que,msgRecordSize(*(uint16_t *)record));
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+			--que->descr->msg->count;
+	}
+}
+
+// Copy the next message to buffer and remove it from the queue. A message
+// longer than size is truncated, *length is set to its full length
+// Return: True if a message was received
+bool msgReceive(volatile queue_t *que, void *buffer, uint16_t size, uint16_t *length)
+{
+	void		*msg;
+
+	if(!msgPeek(que,&msg,length))
+		return(false);
+
+	memcpy(buffer,msg,*length < size ? *length : size);
+	msgRelease(que);
+	return(true);
+}
@@ -0,0 +1,61 @@
+/*
+ * message.h
+ *
+ * Header for message queues. A message queue is a byte queue that stores
+ * variable length, length prefixed messages (records) in its ring buffer.
+ * Includes the macro to create new message queues (ADD_MSG_QUEUE)
+ *
+ * Copyright (C) 2021 by John Anderson <racerxr650r@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR
+ * IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef MESSAGE_H_
+#define MESSAGE_H_
+
+// Includes -------------------------------------------------------------------
+#include "../avrOS.h"
+
+// Constants ------------------------------------------------------------------
+#define MSG_HEADER_SIZE		sizeof(uint16_t)	// Length prefix of each message
+#define MSG_PAD				0xffff				// Length of the record that skips the end of the buffer
+
+// Types ----------------------------------------------------------------------
+typedef struct MSG_STATS_TYPE
+{
+	uint16_t	count;		// Messages in the queue
+	uint16_t	maxCount;	// High water mark of count
+	uint16_t	maxLength;	// Largest message sent
+	uint32_t	dropped;	// Messages that didn't fit
+}msgStats_t;
+
+// Macros ----------------------------------------------------------------------
+// Adds a message queue with a msgSz byte ring buffer. Each message takes its
+// length rounded up to even plus MSG_HEADER_SIZE bytes. Messages are never
+// split across the end of the buffer, so they can be read in place. The queue
+// is registered in QUE_TABLE and triggers the usual queue events
+#define ADD_MSG_QUEUE(msgName, msgSz) \
+                  _Static_assert(!((msgSz)&1), "Message queue size must be even"); \
+                  static volatile msgStats_t CONCAT(msgName,_msg); \
+                  QUE_DECLARE(msgName, 1, msgSz, msgSz, .mode = QUE_MODE_LOCKED, .msg = &CONCAT(msgName,_msg))
+
+// External Functions ---------------------------------------------------------
+static inline uint16_t msgGetCount(volatile queue_t *que)
+{
+	return(que->descr->msg->count);
+}
+
+bool msgSend(volatile queue_t *que, const void *msg, uint16_t length);
+bool msgPeek(volatile queue_t *que, void **msg, uint16_t *length);
+void msgRelease(volatile queue_t *que);
+bool msgReceive(volatile queue_t *que, void *buffer, uint16_t size, uint16_t *length);
+
+#endif /* MESSAGE_H_ */
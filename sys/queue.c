@@ -35,21 +35,272 @@ static int queCmd(int argc, char *argv[])
 	{
 		if(argc<2 || (argc==2 && !strcmp(descr->name,argv[1])))
 		{
-			printf(BOLD UNDERLINE FG_BLUE "%-20s Capacity: %8d Max:%8d\n\r" RESET,descr->name,descr->capacity,descr->queue->max);
-			printf("\tIn:%8lu\tOut:%8lu\tOverflow:%8lu\n\r",descr->queue->stats.in,descr->queue->stats.out,descr->queue->stats.overflow);
+			printf(BOLD UNDERLINE FG_BLUE "%-20s Capacity: %8u Max:%8u %s\n\r" RESET,descr->name,descr->capacity,descr->queue->max,descr->mode == QUE_MODE_SPSC?"SPSC":"");
+			printf("\tSize:%8u\tHigh:%8u\tLow:%8u\n\r",queGetSize(descr->queue),descr->queue->high,descr->queue->low);
+			if(descr->msg != NULL)
+				printf("\tMessages:%4u\tMax:%8u\tLargest:%4u\tDropped:%8lu\n\r",descr->msg->count,descr->msg->maxCount,descr->msg->maxLength,descr->msg->dropped);
+			printf("\tIn:%8lu\tOut:%8lu\tOverflow:%8lu\tBlocked:%8lu\n\r",descr->queue->stats.in,descr->queue->stats.out,descr->queue->stats.overflow,descr->queue->stats.blocked);
 		}
 	}
 	return(0);
 }
 #endif // QUE_CLI
 
+// Internal functions ************************************************
+// Add count elements already written at the tail to a locked queue. Must be
+// called with interrupts disabled and count no more than the free slots
+static void queLockedAdvanceTail(volatile queue_t *que, uint16_t count)
+{
+	const queDescriptor_t *descr = que->descr;
+	uint16_t		capacity = descr->capacity, tail = que->tail, before = queGetSize(que), used;
+
+#ifdef QUE_STATS
+	descr->queue->stats.in += count;
+#endif
+	// If the buffer was previously empty...
+	if(que->head == capacity)
+	{
+		// Point the head to the first element just added
+		que->head = tail;
+		evntTrigger(descr->event, QUE_EVENT_NOT_EMPTY);
+		TRACE(TRC_QUE,QUE_EVENT_NOT_EMPTY,que,0);
+	}
+
+	// Advance the tail pointer and wrap if needed
+	tail += count;
+	if(tail >= capacity)
+		tail -= capacity;
+
+	// Is the queue now full...
+	if(tail == que->head)
+	{
+		// Point the tail beyond the buffer
+		tail = capacity;
+		evntTrigger(descr->event, QUE_EVENT_FULL);
+		TRACE(TRC_QUE,QUE_EVENT_FULL,que,0);
+	}
+	que->tail = tail;
+
+	used = before + count;
+	queCheckAbove(que,before,used);
+
+	// If the current capacity of queueue exceeds the previous max, update the max
+	if(used > descr->queue->max)
+		descr->queue->max = used;
+}
+
+// Remove count elements from the head of a locked queue. Must be called with
+// interrupts disabled and count no more than the elements in the queue
+static void queLockedAdvanceHead(volatile queue_t *que, uint16_t count)
+{
+	const queDescriptor_t *descr = que->descr;
+	uint16_t		capacity = descr->capacity, head = que->head, before = queGetSize(que);
+
+#ifdef QUE_STATS
+	descr->queue->stats.out += count;
+#endif
+	// If the buffer was previously full...
+	if(que->tail == capacity)
+	{
+		// Point the tail at the first empty slot
+		que->tail = head;
+		evntTrigger(descr->event,QUE_EVENT_NOT_FULL);
+		TRACE(TRC_QUE,QUE_EVENT_NOT_FULL,que,0);
+	}
+
+	// Advance the head pointer and wrap if needed
+	head += count;
+	if(head >= capacity)
+		head -= capacity;
+
+	// If the buffer is now empty...
+	if(head == que->tail)
+	{
+		// Set the head pointer to show that
+		head = capacity;
+		evntTrigger(descr->event,QUE_EVENT_EMPTY);
+		TRACE(TRC_QUE,QUE_EVENT_EMPTY,que,0);
+	}
+	que->head = head;
+	queCheckBelow(que,before,before-count);
+}
+
+// Hand count elements already written at the tail of a single producer/single
+// consumer queue to the consumer. Only the producer writes the tail and only
+// the consumer writes the head, so the copy needs no critical section. Only
+// the two byte index store briefly disables interrupts
+static void queSpscAdvanceTail(volatile queue_t *que, uint16_t count)
+{
+	const queDescriptor_t *descr = que->descr;
+	uint16_t		tail = que->tail, used = tail - queLoadIndex(&que->head);
+
+	queStoreIndex(&que->tail,tail+count);
+#ifdef QUE_STATS
+	descr->queue->stats.in += count;
+#endif
+	// If the buffer was previously empty...
+	if(used == 0)
+	{
+		evntTrigger(descr->event, QUE_EVENT_NOT_EMPTY);
+		TRACE(TRC_QUE,QUE_EVENT_NOT_EMPTY,que,0);
+	}
+	// Is the queue now full...
+	used += count;
+	if(used == descr->capacity)
+	{
+		evntTrigger(descr->event, QUE_EVENT_FULL);
+		TRACE(TRC_QUE,QUE_EVENT_FULL,que,0);
+	}
+	queCheckAbove(que,used-count,used);
+	// If the current capacity of queueue exceeds the previous max, update the max
+	if(used > descr->queue->max)
+		descr->queue->max = used;
+}
+
+// Release count elements at the head of a single producer/single consumer
+// queue back to the producer
+static void queSpscAdvanceHead(volatile queue_t *que, uint16_t count)
+{
+	const queDescriptor_t *descr = que->descr;
+	uint16_t		head = que->head, used = queLoadIndex(&que->tail) - head;
+
+	queStoreIndex(&que->head,head+count);
+#ifdef QUE_STATS
+	descr->queue->stats.out += count;
+#endif
+	// If the buffer was previously full...
+	if(used == descr->capacity)
+	{
+		evntTrigger(descr->event,QUE_EVENT_NOT_FULL);
+		TRACE(TRC_QUE,QUE_EVENT_NOT_FULL,que,0);
+	}
+	// If the buffer is now empty...
+	if(used == count)
+	{
+		evntTrigger(descr->event,QUE_EVENT_EMPTY);
+		TRACE(TRC_QUE,QUE_EVENT_EMPTY,que,0);
+	}
+	queCheckBelow(que,used,used-count);
+}
+
+// Find the contiguous run of free slots at the tail of the queue
+// Return: The number of free slots starting at the tail, *index set to the first
+static uint16_t queGetFreeSpan(volatile queue_t *que, uint16_t *index)
+{
+	const queDescriptor_t *descr = que->descr;
+	uint16_t		capacity = descr->capacity, ret;
+
+	if(descr->mode == QUE_MODE_SPSC)
+	{
+		uint16_t	tail = que->tail;
+
+		*index = tail & (capacity-1);
+		ret = capacity - (uint16_t)(tail - queLoadIndex(&que->head));
+	}
+	else
+	{
+		// Full
+		if(que->tail == capacity)
+			return(0);
+		*index = que->tail;
+		ret = que->head > que->tail && que->head < capacity ? que->head - que->tail : capacity;
+	}
+	// No further than the end of the buffer
+	if(ret > capacity - *index)
+		ret = capacity - *index;
+	return(ret);
+}
+
+// Find the contiguous run of elements at the head of the queue
+// Return: The number of elements starting at the head, *index set to the first
+static uint16_t queGetUsedSpan(volatile queue_t *que, uint16_t *index)
+{
+	const queDescriptor_t *descr = que->descr;
+	uint16_t		capacity = descr->capacity, ret;
+
+	if(descr->mode == QUE_MODE_SPSC)
+	{
+		uint16_t	head = que->head;
+
+		*index = head & (capacity-1);
+		ret = queLoadIndex(&que->tail) - head;
+	}
+	else
+	{
+		// Empty
+		if(que->head == capacity)
+			return(0);
+		*index = que->head;
+		ret = que->tail > que->head && que->tail < capacity ? que->tail - que->head : capacity;
+	}
+	// No further than the end of the buffer
+	if(ret > capacity - *index)
+		ret = capacity - *index;
+	return(ret);
+}
+
+// Copy up to count elements from the head of the queue without removing them.
+// The elements are copied as at most two spans, before and after the wrap
+// Return: The number of elements copied
+static uint16_t queCopyOut(volatile queue_t *que, void *elements, uint16_t count)
+{
+	const queDescriptor_t *descr = que->descr;
+	uint16_t		capacity = descr->capacity, ret, index, span;
+	size_t			size = descr->sizeOfElement;
+
+	// Get no more elements than are in the queue
+	ret = queGetSize(que);
+	if(count < ret)
+		ret = count;
+	if(ret)
+	{
+		index = descr->mode == QUE_MODE_SPSC ? que->head & (capacity-1) : que->head;
+		span = capacity-index < ret ? capacity-index : ret;
+		memcpy(elements,&(descr->buffer[index*size]),span*size);
+		memcpy((uint8_t *)elements+span*size,descr->buffer,(ret-span)*size);
+	}
+	return(ret);
+}
+
+// Copy up to count elements into the free slots at the tail of the queue
+// without adding them. The elements are copied as at most two spans
+// Return: The number of elements copied
+static uint16_t queCopyIn(volatile queue_t *que, const void *elements, uint16_t count)
+{
+	const queDescriptor_t *descr = que->descr;
+	uint16_t		capacity = descr->capacity, ret, index, span;
+	size_t			size = descr->sizeOfElement;
+
+	// Put no more elements than there is room for
+	ret = capacity - queGetSize(que);
+	if(count < ret)
+		ret = count;
+	if(ret)
+	{
+		index = descr->mode == QUE_MODE_SPSC ? que->tail & (capacity-1) : que->tail;
+		span = capacity-index < ret ? capacity-index : ret;
+		memcpy(&(descr->buffer[index*size]),elements,span*size);
+		memcpy(descr->buffer,(const uint8_t *)elements+span*size,(ret-span)*size);
+	}
+	return(ret);
+}
+
 // External functions ************************************************
+// Trigger a queue event for the inline typed queue functions
+void queTrigger(volatile queue_t *que, queueEvents_t event)
+{
+	evntTrigger(que->descr->event,event);
+	TRACE(TRC_QUE,event,que,0);
+}
+
 uint16_t queGetSize(volatile queue_t *que)
 {
 	const queDescriptor_t *descr = que->descr;
 	uint16_t			ret;
 	
-	if(queIsEmpty(que))
+	if(descr->mode == QUE_MODE_SPSC)
+		ret = queLoadIndex(&que->tail) - queLoadIndex(&que->head);
+	else if(queIsEmpty(que))
 		ret = 0;
 	else if(queIsFull(que))
 		ret = descr->capacity;
@@ -63,100 +314,222 @@ uint16_t queGetSize(volatile queue_t *que)
 	return(ret);	
 }
 
+// Get one element from the queue
+// Return: True if an element was copied to element
 bool queGet(volatile queue_t *que, void *element)
 {
-	const queDescriptor_t *descr = que->descr;
-	bool			ret = false;
-	
-	// Start of critical section
+	return(queGetN(que,element,1) != 0);
+}
+
+// Put one element into the queue
+// Return: True if the element was added, false if the queue is full
+bool quePut(volatile queue_t *que, void *element)
+{
+	return(quePutN(que,element,1) != 0);
+}
+
+// Set the queue size watermarks. QUE_EVENT_ABOVE_N is triggered when the size
+// rises to high and QUE_EVENT_BELOW_N when it falls to low. 0 disables either.
+// A watermark replaced by queArmAbove()/queArmBelow() takes the new value when
+// it is put back
+void queSetWatermarks(volatile queue_t *que, uint16_t high, uint16_t low)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if(que->savedHigh != QUE_NOT_ARMED)
+			que->savedHigh = high;
+		else
+			que->high = high;
+		if(que->savedLow != QUE_NOT_ARMED)
+			que->savedLow = low;
+		else
+			que->low = low;
+	}
+}
+
+// Trigger QUE_EVENT_ABOVE_N once when the size rises to level, which must be
+// above the current size. The high watermark is replaced until then and put
+// back when the event is triggered, so waits don't change it for other users
+void queArmAbove(volatile queue_t *que, uint16_t level)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if(que->savedHigh == QUE_NOT_ARMED)
+			que->savedHigh = que->high;
+		que->high = level;
+	}
+}
+
+// Trigger QUE_EVENT_BELOW_N once when the size falls to level, which must be
+// below the current size. The low watermark is replaced until then and put
+// back when the event is triggered, so waits don't change it for other users
+void queArmBelow(volatile queue_t *que, uint16_t level)
+{
 	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 	{
-		// If not empty
-		if(que->head < descr->capacity)
+		if(que->savedLow == QUE_NOT_ARMED)
+			que->savedLow = que->low;
+		que->low = level;
+	}
+}
+
+// Get up to count elements from the queue. The elements are copied as at most
+// two spans (before and after the buffer wraps) and the queue events are
+// triggered once for the batch. Locked queues do this in one critical section
+// Return: The number of elements copied to elements
+uint16_t queGetN(volatile queue_t *que, void *elements, uint16_t count)
+{
+	uint16_t		ret;
+
+	// If a single producer/single consumer queue...
+	if(que->descr->mode == QUE_MODE_SPSC)
+	{
+		if((ret = queCopyOut(que,elements,count)))
+			queSpscAdvanceHead(que,ret);
+	}
+	else
+	{
+		// Start of critical section
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 		{
-			// Get the element from the head of the queue
-			memcpy(element,&(descr->buffer[que->head*descr->sizeOfElement]),descr->sizeOfElement);
-			// *ch = que->buffer[queue->head];
-#ifdef QUE_STATS
-			++descr->queue->stats.out;
-#endif
-			// If the buffer was previously full...
-			if(que->tail == descr->capacity)
-			{
-				// Point the tail at the new empty slot
-				que->tail = que->head;
-				evntTrigger(descr->event,QUE_EVENT_NOT_FULL);
-			}
-			
-			// Increment the head pointer and wrap if needed
-			if(++que->head == descr->capacity)
-				que->head = 0;
+			if((ret = queCopyOut(que,elements,count)))
+				queLockedAdvanceHead(que,ret);
+		} // End of critical section
+	}
+	return(ret);
+}
 
-			// If the buffer is now empty...
-			if(que->tail == que->head)
+// Put up to count elements into the queue. The elements are copied as at most
+// two spans (before and after the buffer wraps) and the queue events are
+// triggered once for the batch. Locked queues do this in one critical section
+// Return: The number of elements copied from elements
+uint16_t quePutN(volatile queue_t *que, const void *elements, uint16_t count)
+{
+	uint16_t		ret = 0;
+
+	// If a single producer/single consumer queue...
+	if(que->descr->mode == QUE_MODE_SPSC)
+	{
+		if((ret = queCopyIn(que,elements,count)))
+			queSpscAdvanceTail(que,ret);
+	}
+	else
+	{
+		// Start of critical section
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+		{
+			// The slots at the tail belong to the queReserve() outstanding. The
+			// elements are counted as blocked rather than overflow
+			if(que->reserved)
 			{
-				// Set the head pointer to show that
-				que->head = descr->capacity;
-				evntTrigger(descr->event,QUE_EVENT_EMPTY);
+#ifdef QUE_STATS
+				que->stats.blocked += count;
+#endif
+				count = 0;
 			}
-
-			ret = true;
-		}
-	} // End of critical section
+			else if((ret = queCopyIn(que,elements,count)))
+				queLockedAdvanceTail(que,ret);
+		} // End of critical section
+	}
+#ifdef QUE_STATS
+	// Count the elements that didn't fit. Interrupts may count overflows on
+	// the same queue
+	if(count != ret)
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+			que->descr->queue->stats.overflow += count-ret;
+#endif
 	return(ret);
 }
 
-bool quePut(volatile queue_t *que, void *element)
+// Reserve up to count contiguous free slots at the tail of the queue to be
+// written in place. A nonzero return must be paired with queCommit(), with a
+// count of 0 to add none. A return of 0 reserves nothing and must not be
+// committed, as that would end another producer's reservation. Only one
+// reserve/commit may be outstanding on a queue at a time. On a locked queue,
+// puts from any producer fail (counted as blocked) and other reserves return 0
+// until the commit. On an SPSC queue, the reserve/commit is the single producer
+// Return: The number of slots reserved, *elements set to the first slot
+uint16_t queReserve(volatile queue_t *que, uint16_t count, void **elements)
 {
 	const queDescriptor_t *descr = que->descr;
-	bool			ret = false;
-	
-	// Start of critical section
-	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	uint16_t		index = 0, ret = 0;
+
+	if(descr->mode == QUE_MODE_SPSC)
 	{
-		// If not already full...
-		if(que->tail < descr->capacity)
+		if((ret = queGetFreeSpan(que,&index)) > count)
+			ret = count;
+	}
+	else
+	{
+		// Start of critical section
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 		{
-			// If not full now...
-			if(que->tail != que->head)
+			if(!que->reserved)
 			{
-				// Put the element into the buffer
-				memcpy(&(descr->buffer[que->tail*descr->sizeOfElement]),element,descr->sizeOfElement);
-				//que->buffer[queue->tail] = ch;
-#ifdef QUE_STATS
-				++descr->queue->stats.in;
-#endif			
-				// If the buffer was previously empty...
+				// If empty, start over at the beginning of the buffer so the
+				// free span is as long as possible
 				if(que->head == descr->capacity)
-				{
-					// Point the head to the char just added
-					que->head = que->tail;
-					evntTrigger(descr->event, QUE_EVENT_NOT_EMPTY);
-				}
-				// Increment the tail pointer and wrap
-				if(++que->tail==descr->capacity)
 					que->tail = 0;
-			
-				// Is the queue now full...	
-				if(que->tail == que->head)
-				{
-					// Point the tail beyond the buffer
-					que->tail = descr->capacity;
-					evntTrigger(descr->event, QUE_EVENT_FULL);
-				}
-				
-				// If the current capacity of queueue exceeds the previous max, update the max
-				uint16_t	size = queGetSize(que);
-				if(size>descr->queue->max)
-					descr->queue->max = size;
-				
-				ret = true;
+				if((ret = queGetFreeSpan(que,&index)) > count)
+					ret = count;
+				if(ret)
+					que->reserved = true;
 			}
-		}
-#ifdef QUE_STATS
-		else
-			++descr->queue->stats.overflow;
-#endif
-	} // End of critical section
+		} // End of critical section
+	}
+
+	*elements = &(descr->buffer[index*descr->sizeOfElement]);
 	return(ret);
 }
+
+// Add count elements written to the slots returned by queReserve() to the
+// queue and end the reservation
+void queCommit(volatile queue_t *que, uint16_t count)
+{
+	if(que->descr->mode == QUE_MODE_SPSC)
+	{
+		if(count)
+			queSpscAdvanceTail(que,count);
+	}
+	else
+	{
+		// Start of critical section
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+		{
+			if(count)
+				queLockedAdvanceTail(que,count);
+			que->reserved = false;
+		} // End of critical section
+	}
+}
+
+// Get the contiguous run of elements at the head of the queue to be read in
+// place. The elements are removed from the queue with queRelease()
+// Return: The number of contiguous elements, *elements set to the first
+uint16_t quePeek(volatile queue_t *que, void **elements)
+{
+	const queDescriptor_t *descr = que->descr;
+	uint16_t		index = 0, ret;
+
+	if(descr->mode == QUE_MODE_SPSC)
+		ret = queGetUsedSpan(que,&index);
+	else
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+			ret = queGetUsedSpan(que,&index);
+
+	*elements = &(descr->buffer[index*descr->sizeOfElement]);
+	return(ret);
+}
+
+// Remove count elements returned by quePeek() from the head of the queue
+void queRelease(volatile queue_t *que, uint16_t count)
+{
+	if(count)
+	{
+		if(que->descr->mode == QUE_MODE_SPSC)
+			queSpscAdvanceHead(que,count);
+		else
+			ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+				queLockedAdvanceHead(que,count);
+	}
+}
@@ -10,25 +10,37 @@
 #define QUEUE_H_
 
 // Constants ------------------------------------------------------------------
-#define QUE_MAX_SIZE		255
+#define QUE_MAX_SIZE		32768	// Largest queue capacity, the free-running SPSC indices limit it to 2^15
+#define QUE_NOT_ARMED		0xffff	// No queArmAbove()/queArmBelow() outstanding
 
 // Data Types -----------------------------------------------------------------
+// Queue event types are separate bits so they can be combined in a filter
 typedef enum
 {
-	QUE_EVENT_EMPTY = 1,
-	QUE_EVENT_NOT_EMPTY,
-	QUE_EVENT_FULL,
-	QUE_EVENT_NOT_FULL
+	QUE_EVENT_EMPTY = EVENT_TYPE_1,
+	QUE_EVENT_NOT_EMPTY = EVENT_TYPE_2,
+	QUE_EVENT_FULL = EVENT_TYPE_3,
+	QUE_EVENT_NOT_FULL = EVENT_TYPE_4,
+	QUE_EVENT_ABOVE_N = EVENT_TYPE_5,	// Size rose to the high watermark
+	QUE_EVENT_BELOW_N = EVENT_TYPE_6	// Size fell to the low watermark
 }queueEvents_t;
 
+typedef enum
+{
+	QUE_MODE_LOCKED = 0,	// Any number of producers/consumers, ops run with interrupts disabled
+	QUE_MODE_SPSC			// Single producer/single consumer, free-running indices, only the index stores are atomic
+}queMode_t;
+
 struct QUE_DESCRIPTOR_TYPE;
 struct QUEUE_TYPE;
+struct MSG_STATS_TYPE;
 
 typedef struct
 {
 	uint32_t	in;
 	uint32_t	out;
 	uint32_t	overflow;
+	uint32_t	blocked;	// Elements put while a queReserve() was outstanding
 }queStats_t;
 
 typedef struct QUEUE_TYPE
@@ -36,6 +48,11 @@ typedef struct QUEUE_TYPE
 	uint16_t	            			head;
 	uint16_t							tail;
 	uint16_t							max;
+	uint16_t							high;	// High watermark, 0 = no QUE_EVENT_ABOVE_N
+	uint16_t							low;	// Low watermark, 0 = no QUE_EVENT_BELOW_N
+	uint16_t							savedHigh;	// High watermark replaced by queArmAbove(), else QUE_NOT_ARMED
+	uint16_t							savedLow;	// Low watermark replaced by queArmBelow(), else QUE_NOT_ARMED
+	bool								reserved;	// Locked queue has a queReserve() outstanding, other puts fail
 #ifdef QUE_STATS	
 	volatile queStats_t					stats;
 #endif // QUE_STATS
@@ -52,37 +69,127 @@ typedef struct QUE_DESCRIPTOR_TYPE
 	volatile event_t *event;
 	uint16_t         capacity;
 	size_t           sizeOfElement;
+	queMode_t        mode;
+	volatile struct MSG_STATS_TYPE *msg;	// Message queue stats, NULL if not a message queue
 }queDescriptor_t;
 
 // Macros ----------------------------------------------------------------------
 #ifdef QUE_STATS
-#define ADD_QUEUE(queName, queSzElement, queSz) \
-                  static uint8_t             CONCAT(queName,_buffer)[queSz*queSzElement]; \
-                  const static queDescriptor_t CONCAT(queName,_descr); \
-                  static volatile queue_t    queName = {.head = queSz, .tail = 0, .max = 0, .stats.in = 0, .stats.out = 0, .stats.overflow = 0, .descr = &CONCAT(queName,_descr)}; \
-                  ADD_EVENT(queName ## _evnt); \
-                  const static queDescriptor_t SECTION(QUE_TABLE) CONCAT(queName,_descr) = {.name = #queName, .queue = &queName, .buffer = CONCAT(queName,_buffer), .event = &CONCAT(queName,_evnt), .capacity = queSz, .sizeOfElement = queSzElement};
+#define QUE_NAME(queName)	.name = #queName,
 #else
-#define ADD_QUEUE(queName, queSzElement, queSz)	\
+#define QUE_NAME(queName)
+#endif
+
+// Declares the queue, its buffer, event and descriptor in the QUE_TABLE. The
+// remaining parameters initialize the mode specific descriptor fields
+#define QUE_DECLARE(queName, queSzElement, queSz, queHead, ...) \
+                  _Static_assert((queSz) > 0 && (queSz) <= QUE_MAX_SIZE, "Queue size must be 1 to QUE_MAX_SIZE"); \
                   static uint8_t             CONCAT(queName,_buffer)[queSz*queSzElement]; \
                   const static queDescriptor_t CONCAT(queName,_descr); \
-                  static volatile queue_t    queName = {.head = queSz, .tail = 0, .max = 0, .descr = &CONCAT(queName,_descr)}; \
+                  static volatile queue_t    queName = {.head = queHead, .tail = 0, .max = 0, .savedHigh = QUE_NOT_ARMED, .savedLow = QUE_NOT_ARMED, .reserved = false, .descr = &CONCAT(queName,_descr)}; \
                   ADD_EVENT(queName ## _evnt); \
-                  const static queDescriptor_t SECTION(QUE_TABLE) CONCAT(queName,_descr) = {.queue = &queName, .buffer = CONCAT(queName,_buffer), .event = &CONCAT(queName,_evnt), .capacity = queSz, .sizeOfElement = queSzElement};
-#endif
+                  const static queDescriptor_t SECTION(QUE_TABLE) CONCAT(queName,_descr) = {QUE_NAME(queName) .queue = &queName, .buffer = CONCAT(queName,_buffer), .event = &CONCAT(queName,_evnt), .capacity = queSz, .sizeOfElement = queSzElement, __VA_ARGS__};
+
+#define ADD_QUEUE(queName, queSzElement, queSz) \
+                  QUE_DECLARE(queName, queSzElement, queSz, queSz, .mode = QUE_MODE_LOCKED)
+// Single producer/single consumer queue, queSz must be a power of 2. Only one
+// context may put and one may get, so a queue written from both the main loop
+// and an interrupt must use ADD_QUEUE()
+#define ADD_SPSC_QUEUE(queName, queSzElement, queSz) \
+                  _Static_assert((queSz) && !((queSz)&((queSz)-1)), "SPSC queue size must be a power of 2"); \
+                  QUE_DECLARE(queName, queSzElement, queSz, 0, .mode = QUE_MODE_SPSC)
+
+// Adds a queue of queType elements with inline CONCAT(queName,_get)(queType *)
+// and CONCAT(queName,_put)(queType) functions. The element size and capacity
+// are compile time constants in these functions, so the index math and copy
+// fold to a few instructions. The queue is also registered in QUE_TABLE and
+// works with the generic que*() functions
+#define ADD_TYPED_QUEUE(queName, queType, queSz) \
+                  ADD_QUEUE(queName, sizeof(queType), queSz); \
+                  static inline bool CONCAT(queName,_get)(queType *element) {return(queTypedGet(&queName,CONCAT(queName,_buffer),element,sizeof(queType),queSz));} \
+                  static inline bool CONCAT(queName,_put)(queType element) {return(queTypedPut(&queName,CONCAT(queName,_buffer),&element,sizeof(queType),queSz));}
+// Single producer/single consumer version of ADD_TYPED_QUEUE(), queSz must be a power of 2
+#define ADD_TYPED_SPSC_QUEUE(queName, queType, queSz) \
+                  ADD_SPSC_QUEUE(queName, sizeof(queType), queSz); \
+                  static inline bool CONCAT(queName,_get)(queType *element) {return(queTypedSpscGet(&queName,CONCAT(queName,_buffer),element,sizeof(queType),queSz));} \
+                  static inline bool CONCAT(queName,_put)(queType element) {return(queTypedSpscPut(&queName,CONCAT(queName,_buffer),&element,sizeof(queType),queSz));}
 
 // External Functions ---------------------------------------------------------
+extern void queTrigger(volatile queue_t *que, queueEvents_t event);
+
+// Read a free-running SPSC index that the other side may update from an
+// interrupt. The two byte read is repeated until it is stable, so it can't
+// return a torn value, and the barrier keeps buffer accesses after it
+static inline uint16_t queLoadIndex(volatile uint16_t *index)
+{
+	uint16_t	value;
+
+	do
+		value = *index;
+	while(value != *index);
+	__asm__ __volatile__ ("" ::: "memory");
+	return(value);
+}
+
+// Publish a free-running SPSC index. The other side only reads it, so just the
+// two byte store is done with interrupts disabled to keep it from tearing
+static inline void queStoreIndex(volatile uint16_t *index, uint16_t value)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+		*index = value;
+}
+
+// Trigger QUE_EVENT_ABOVE_N if the size rose to or past the high watermark.
+// Puts back the high watermark a queArmAbove() replaced
+static inline void queCheckAbove(volatile queue_t *que, uint16_t before, uint16_t after)
+{
+	if(que->high && before < que->high && after >= que->high)
+	{
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+		{
+			if(que->savedHigh != QUE_NOT_ARMED)
+			{
+				que->high = que->savedHigh;
+				que->savedHigh = QUE_NOT_ARMED;
+			}
+		}
+		queTrigger(que,QUE_EVENT_ABOVE_N);
+	}
+}
+
+// Trigger QUE_EVENT_BELOW_N if the size fell to or past the low watermark.
+// Puts back the low watermark a queArmBelow() replaced
+static inline void queCheckBelow(volatile queue_t *que, uint16_t before, uint16_t after)
+{
+	if(que->low && before > que->low && after <= que->low)
+	{
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+		{
+			if(que->savedLow != QUE_NOT_ARMED)
+			{
+				que->low = que->savedLow;
+				que->savedLow = QUE_NOT_ARMED;
+			}
+		}
+		queTrigger(que,QUE_EVENT_BELOW_N);
+	}
+}
+
 static inline bool queIsEmpty(volatile queue_t *que)
 {
+	if(que->descr->mode == QUE_MODE_SPSC)
+		return(queLoadIndex(&que->head) == queLoadIndex(&que->tail));
 	return(que->head == que->descr->capacity?true:false);
 }
 
 static inline bool queIsFull(volatile queue_t *que)
 {
+	if(que->descr->mode == QUE_MODE_SPSC)
+		return((uint16_t)(queLoadIndex(&que->tail) - queLoadIndex(&que->head)) == que->descr->capacity);
 	return(que->tail == que->descr->capacity?true:false);
 }
 
-static inline uint8_t queGetCapacity(volatile queue_t *que)
+static inline uint16_t queGetCapacity(volatile queue_t *que)
 {
 	return(que->descr->capacity);
 }
@@ -93,7 +200,7 @@ static inline volatile event_t *queGetEvent(volatile queue_t *que)
 }
 
 //#ifdef QUE_STATS
-static inline uint32_t queGetMaxSize(volatile queue_t *que)
+static inline uint16_t queGetMaxSize(volatile queue_t *que)
 {
 	return(que->max);
 }
@@ -114,9 +221,23 @@ static inline uint32_t queGetOverflow(volatile queue_t *que)
 	return(que->stats.overflow);
 }
 
+static inline uint32_t queGetBlocked(volatile queue_t *que)
+{
+	return(que->stats.blocked);
+}
+
 #endif
 
 extern uint16_t queGetSize(volatile queue_t *que);
+extern void queSetWatermarks(volatile queue_t *que, uint16_t high, uint16_t low);
+extern void queArmAbove(volatile queue_t *que, uint16_t level);
+extern void queArmBelow(volatile queue_t *que, uint16_t level);
+extern uint16_t queGetN(volatile queue_t *que, void *elements, uint16_t count);
+extern uint16_t quePutN(volatile queue_t *que, const void *elements, uint16_t count);
+extern uint16_t queReserve(volatile queue_t *que, uint16_t count, void **elements);
+extern void queCommit(volatile queue_t *que, uint16_t count);
+extern uint16_t quePeek(volatile queue_t *que, void **elements);
+extern void queRelease(volatile queue_t *que, uint16_t count);
 extern bool queGet(volatile queue_t *que, void *element);
 static inline bool queGetByte(volatile queue_t *que, uint8_t *byte)
 {
@@ -144,4 +265,152 @@ static inline bool quePutPtr(volatile queue_t *que, void *ptr)
 	return(quePutWord(que,(uint16_t)ptr));
 }
 
+// Typed queue functions. These are called by the functions ADD_TYPED_QUEUE()
+// and ADD_TYPED_SPSC_QUEUE() generate with a constant size and capacity, and
+// are always inlined so the constants fold into the code
+static inline __attribute__((always_inline)) bool queTypedGet(volatile queue_t *que, uint8_t *buffer, void *element, size_t size, uint16_t capacity)
+{
+	bool		ret = false;
+
+	// Start of critical section
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		uint16_t	head = que->head;
+
+		// If not empty
+		if(head < capacity)
+		{
+			memcpy(element,&buffer[head*size],size);
+#ifdef QUE_STATS
+			++que->stats.out;
+#endif
+			// If the buffer was previously full, point the tail at the new empty slot
+			if(que->tail == capacity)
+			{
+				que->tail = head;
+				queTrigger(que,QUE_EVENT_NOT_FULL);
+			}
+			// Increment the head pointer and wrap if needed
+			if(++head == capacity)
+				head = 0;
+			// If the buffer is now empty...
+			if(head == que->tail)
+			{
+				head = capacity;
+				queTrigger(que,QUE_EVENT_EMPTY);
+			}
+			que->head = head;
+			if(que->low)
+			{
+				uint16_t	used = queGetSize(que);
+				queCheckBelow(que,used+1,used);
+			}
+			ret = true;
+		}
+	} // End of critical section
+	return(ret);
+}
+
+static inline __attribute__((always_inline)) bool queTypedPut(volatile queue_t *que, uint8_t *buffer, const void *element, size_t size, uint16_t capacity)
+{
+	bool		ret = false;
+
+	// Start of critical section
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		uint16_t	tail = que->tail, used;
+
+		// If not already full or reserved...
+		if(tail < capacity && !que->reserved)
+		{
+			memcpy(&buffer[tail*size],element,size);
+#ifdef QUE_STATS
+			++que->stats.in;
+#endif
+			// If the buffer was previously empty, point the head to the element just added
+			if(que->head == capacity)
+			{
+				que->head = tail;
+				queTrigger(que,QUE_EVENT_NOT_EMPTY);
+			}
+			// Increment the tail pointer and wrap
+			if(++tail == capacity)
+				tail = 0;
+			// Is the queue now full...
+			if(tail == que->head)
+			{
+				tail = capacity;
+				used = capacity;
+				queTrigger(que,QUE_EVENT_FULL);
+			}
+			else
+				used = tail > que->head ? tail - que->head : capacity - (que->head - tail);
+			que->tail = tail;
+			queCheckAbove(que,used-1,used);
+
+			// If the current capacity of queueue exceeds the previous max, update the max
+			if(used > que->max)
+				que->max = used;
+			ret = true;
+		}
+#ifdef QUE_STATS
+		else if(que->reserved)
+			++que->stats.blocked;
+		else
+			++que->stats.overflow;
+#endif
+	} // End of critical section
+	return(ret);
+}
+
+static inline __attribute__((always_inline)) bool queTypedSpscGet(volatile queue_t *que, uint8_t *buffer, void *element, size_t size, uint16_t capacity)
+{
+	uint16_t	head = que->head, used = queLoadIndex(&que->tail) - head;
+
+	// If empty
+	if(!used)
+		return(false);
+
+	memcpy(element,&buffer[(head & (capacity-1))*size],size);
+	queStoreIndex(&que->head,head+1);
+#ifdef QUE_STATS
+	++que->stats.out;
+#endif
+	if(used == capacity)
+		queTrigger(que,QUE_EVENT_NOT_FULL);
+	if(used == 1)
+		queTrigger(que,QUE_EVENT_EMPTY);
+	queCheckBelow(que,used,used-1);
+	return(true);
+}
+
+static inline __attribute__((always_inline)) bool queTypedSpscPut(volatile queue_t *que, uint8_t *buffer, const void *element, size_t size, uint16_t capacity)
+{
+	uint16_t	tail = que->tail, used = tail - queLoadIndex(&que->head);
+
+	// If full
+	if(used == capacity)
+	{
+#ifdef QUE_STATS
+		++que->stats.overflow;
+#endif
+		return(false);
+	}
+
+	memcpy(&buffer[(tail & (capacity-1))*size],element,size);
+	queStoreIndex(&que->tail,tail+1);
+#ifdef QUE_STATS
+	++que->stats.in;
+#endif
+	if(used == 0)
+		queTrigger(que,QUE_EVENT_NOT_EMPTY);
+	if(++used == capacity)
+		queTrigger(que,QUE_EVENT_FULL);
+	queCheckAbove(que,used-1,used);
+	// If the current capacity of queueue exceeds the previous max, update the max
+	if(used > que->max)
+		que->max = used;
+	return(true);
+}
+
 #endif /* QUEUE_H_ */
@@ -23,6 +23,12 @@
 
 // Globals --------------------------------------------------------------------
 static volatile uint32_t	sysTicks = 0;
+// Count of peripherals that need the main clock to keep running in sleep
+static volatile uint8_t		sysSleepLocks = 0;
+// Tick timer scale, updated when the tick frequency is set
+static uint8_t				sysTimerDiv = 2;	// CPU cycles per tick timer count
+static uint16_t				sysTimerKHz = 1;	// Tick timer clock in kHz
+static uint16_t				sysTickUs = 0;		// Microseconds per tick
 
 // Event for system timer ticks to update the waiting state machines
 ADD_EVENT(tick);
@@ -30,10 +36,13 @@ ADD_EVENT(tick);
 // Interrupt Handler ----------------------------------------------------------
 #if SYS_TICK_TIMER==SYS_TIMER_TCB0
 #define SYS_TICK_INT_VECT TCB0_INT_vect
+#define SYS_TICK_INT_NUM  TCB0_INT_vect_num
 #elif SYS_TICK_TIMER==SYS_TIMER_TCB1
 #define SYS_TICK_INT_VECT TCB1_INT_vect
+#define SYS_TICK_INT_NUM  TCB1_INT_vect_num
 #elif SYS_TICK_TIMER==SYS_TIMER_TCB2
 #define SYS_TICK_INT_VECT TCB1_INT_vect
+#define SYS_TICK_INT_NUM  TCB1_INT_vect_num
 #endif
 
 ISR(SYS_TICK_INT_VECT)
@@ -44,9 +53,26 @@ ISR(SYS_TICK_INT_VECT)
 	// Increment the tick counter
 	++sysTicks;
 
-	// Trigger the timer update event
-	evntTrigger(&tick,EVENT_TYPE_TICK);	
+	// If a state machine tick wait or a timer has expired, trigger the timer
+	// update event. Only these ticks are traced so idle ticks don't flood the
+	// trace
+	if(fsmWaitTicksExpired(sysTicks) || tmrExpired(sysTicks))
+	{
+		TRACE_ISR(SYS_TICK_INT_NUM);
+		evntTrigger(&tick,EVENT_TYPE_TICK);
+	}
+}
+
+#ifdef SYS_TICKLESS
+// RTC compare match wakes the system from a tickless sleep
+ISR(RTC_CNT_vect)
+{
+	TRACE_ISR(RTC_CNT_vect_num);
+
+	// Clear the interrupt
+	RTC.INTFLAGS = RTC_CMP_bm;
 }
+#endif
 
 // Command line interface -----------------------------------------------------
 #ifdef SYS_CLI
@@ -93,10 +119,85 @@ int tickFreqCmd(int argc, char *argv[])
 int sysUpdateWaitTicks(volatile fsmStateMachine_t *sm)
 {
 	fsmUpdateWaitTicks();
+	tmrUpdate();
 	evntEnable(&tick,EVENT_TYPE_TICK,sysUpdateWaitTicks,NULL);
 	return(0);
 }
 
+#ifdef SYS_TICKLESS
+// Start the RTC as a free running counter clocked by the internal 32.768 kHz
+// oscillator. It keeps time while the tick timer is stopped
+static void sysInitRtc()
+{
+	// Wait for the RTC registers to synchronize
+	while(RTC.STATUS);
+	RTC.CLKSEL = RTC_CLKSEL_OSC32K_gc;
+	RTC.PER = 0xffff;
+	RTC.CTRLA = RTC_PRESCALER_DIV1_gc | RTC_RUNSTDBY_bm | RTC_RTCEN_bm;
+}
+
+// Stop the tick timer and sleep on the RTC for up to the given number of
+// ticks. Called with interrupts disabled. On wake, the tick count is caught up
+// with the time spent asleep and the tick timer restarted in phase
+static void sysSleepTickless(uint32_t ticks)
+{
+	TCB_t		*tcb = (TCB_t *)SYS_TICK_TIMER;
+	uint32_t	tickHz = sysGetTickHz();
+	uint32_t	elapsed, maxTicks = (uint32_t)0xff00*tickHz/SYS_RTC_FREQ;
+	uint16_t	start;
+
+	// Limit the sleep to the range of the 16 bit RTC
+	if(ticks > maxTicks)
+		ticks = maxTicks;
+
+	// Stop the tick timer and save the partial tick in RTC counts x tick Hz
+	tcb->CTRLA &= ~TCB_ENABLE_bm;
+	elapsed = (uint32_t)tcb->CNT*SYS_RTC_FREQ/tcb->CCMP;
+
+	// Set the RTC compare to wake up when the next tick wait is due
+	start = RTC.CNT;
+	while(RTC.STATUS & RTC_CMPBUSY_bm);
+	RTC.CMP = start + (uint16_t)((ticks*SYS_RTC_FREQ+tickHz-1)/tickHz);
+	RTC.INTFLAGS = RTC_CMP_bm;
+	RTC.INTCTRL = RTC_CMP_bm;
+
+	// Sleep in standby unless a peripheral needs the main clock
+	set_sleep_mode(sysSleepLocks?SLEEP_MODE_IDLE:SLEEP_MODE_STANDBY);
+	sleep_enable();
+	sei();
+	sleep_cpu();
+	sleep_disable();
+	cli();
+	RTC.INTCTRL = 0;
+
+	// Catch up the tick count with the time asleep and carry the remainder
+	// back into the tick timer so the tick phase is kept
+	elapsed += (uint32_t)(uint16_t)(RTC.CNT-start)*tickHz;
+	sysTicks += elapsed/SYS_RTC_FREQ;
+	tcb->CNT = (uint16_t)((elapsed%SYS_RTC_FREQ)*tcb->CCMP/SYS_RTC_FREQ);
+	tcb->INTFLAGS = TCB_CAPT_bm;
+	tcb->CTRLA |= TCB_ENABLE_bm;
+
+	// If a state machine tick wait or timer expired while asleep, trigger the
+	// update
+	if(fsmWaitTicksExpired(sysTicks) || tmrExpired(sysTicks))
+		evntTrigger(&tick,EVENT_TYPE_TICK);
+
+	sei();
+}
+#endif // SYS_TICKLESS
+
+// Update the tick timer scale used to convert the timer count to cycles and
+// microseconds
+static void sysSetTimerScale(TCB_t *tcb)
+{
+	uint16_t cpuFreq = cpuGetFrequency();
+
+	sysTimerDiv = cpuFreq==1000?1:2;
+	sysTimerKHz = cpuFreq/sysTimerDiv;
+	sysTickUs = (uint32_t)tcb->CCMP*1000/sysTimerKHz;
+}
+
 void sysInitTick(TCB_t *tcb, uint16_t sysTickFreq)
 {
 	uint32_t		cpuFreq = cpuGetFrequency();
@@ -131,6 +232,12 @@ void sysInitTick(TCB_t *tcb, uint16_t sysTickFreq)
 		tcb->CTRLA |= TCB_ENABLE_bm;
 	}
 
+	sysSetTimerScale(tcb);
+
+#ifdef SYS_TICKLESS
+	sysInitRtc();
+#endif
+
 	evntEnable(&tick,EVENT_TYPE_TICK,sysUpdateWaitTicks,NULL);
 }
 
@@ -142,6 +249,12 @@ bool sysInit()
 	// Setup the internal CPU clock source
 	cpuSetOSCHF(CPU_SPEED,false,0);
 
+	// Keep the crash record of the last run, before the stack fill overwrites
+	// its stack high-water mark
+#ifdef SYS_CRASH
+	crashInit();
+#endif
+
 	// Fill the stack area with pattern to detect max stack size
 	memStackFill();
 
@@ -163,6 +276,11 @@ bool sysInit()
 	INFO("Const ROM used: %2d.%02d%%",percentWhole(memConstRomUsed,memConstRom),percentPlaces(memConstRomUsed,memConstRom));
 	INFO("RAM used: %2d.%02d%%",percentWhole(memRamUsed,memRam),percentPlaces(memRamUsed,memRam));
 
+	// Report the crash of the last run
+#ifdef SYS_CRASH
+	crashReport();
+#endif
+
 	return(true);
 }
 
@@ -184,10 +302,11 @@ void sysSetTickFreq(uint16_t sysTickFreq)
 	{
 		// Set the top to divisor for tick freq
 		((TCB_t *)SYS_TICK_TIMER)->CCMP = tickDivisor;
+		sysSetTimerScale((TCB_t *)SYS_TICK_TIMER);
 	}
 }
 
-// Return the system tick frequency in Hz
+// Return the system tick frequency in kHz
 uint16_t sysGetTickFreq()
 {
 	uint32_t		cpuFreq = cpuGetFrequency();
@@ -201,16 +320,129 @@ uint16_t sysGetTickFreq()
 	return(sysTickFreq);
 }
 
+// Return the system tick frequency in Hz from the tick timer period
+uint32_t sysGetTickHz()
+{
+	uint32_t		cpuFreq = cpuGetFrequency();
+	TCB_t			*tcb = (TCB_t *)SYS_TICK_TIMER;
+
+	return(cpuFreq==1000?1000000UL/tcb->CCMP:cpuFreq*1000UL/(2*tcb->CCMP));
+}
+
 // Return the current system tick count
 uint32_t sysGetTickCount()
 {
-	return(sysTicks);
+	uint32_t ticks;
+
+	// Read the 32 bit count without the tick interrupt changing it
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		ticks = sysTicks;
+	}
+
+	return(ticks);
 }
 
-// Put the system to sleep until the next interrupt
+// Return the system tick count and the tick timer count within the tick, read
+// as one consistent sample
+uint32_t sysGetTickAndCount(uint16_t *count)
+{
+	TCB_t		*tcb = (TCB_t *)SYS_TICK_TIMER;
+	uint32_t	ticks;
+	uint16_t	cnt;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		cnt = tcb->CNT;
+		ticks = sysTicks;
+		// If the timer has wrapped and the tick interrupt is still pending,
+		// count the tick and read the count again after the wrap
+		if(tcb->INTFLAGS & TCB_CAPT_bm)
+		{
+			cnt = tcb->CNT;
+			++ticks;
+		}
+	}
+
+	*count = cnt;
+	return(ticks);
+}
+
+// Return the free running CPU cycle count. Wraps every 2^32 cycles, so use the
+// difference between two counts
+uint32_t sysGetCycles()
+{
+	uint16_t	cnt;
+	uint32_t	ticks = sysGetTickAndCount(&cnt);
+
+	return((ticks*((TCB_t *)SYS_TICK_TIMER)->CCMP + cnt)*sysTimerDiv);
+}
+
+// Return the free running time in microseconds. Wraps every 2^32 us (~71
+// minutes), so use the difference between two times
+uint32_t sysGetTimeUs()
+{
+	uint16_t	cnt;
+	uint32_t	ticks = sysGetTickAndCount(&cnt);
+
+	return(ticks*sysTickUs + (uint32_t)cnt*1000/sysTimerKHz);
+}
+
+// Put the system to sleep until the next interrupt. In tickless mode, the
+// tick timer is stopped and the system sleeps until the next tick wait is due
 void sysSleep()
 {
+	cli();
+
+	// If an event is pending, don't sleep on it
+	if(evntPending())
+	{
+		sei();
+		return;
+	}
+
+#ifdef SYS_TICKLESS
+	uint32_t	wake, ticks = 0xffffffff;
+
+	// If a state machine is waiting on the tick, sleep until it's due
+	if(fsmGetNextWaitTick(&wake))
+		ticks = (int32_t)(wake-sysTicks) > 0 ? wake-sysTicks : 0;
+	// If a timer is due sooner, sleep until the timer is due
+	if(tmrGetNextTick(&wake) && ((int32_t)(wake-sysTicks) <= 0 || wake-sysTicks < ticks))
+		ticks = (int32_t)(wake-sysTicks) > 0 ? wake-sysTicks : 0;
+
+	// If nothing is due before the next tick, stop the tick
+	if(ticks > 1)
+	{
+		sysSleepTickless(ticks);
+		return;
+	}
+#endif
+
 	set_sleep_mode(SLEEP_MODE_IDLE);
-	sleep_mode();
+	sleep_enable();
+	// The instruction after sei() is executed before any interrupt
+	sei();
+	sleep_cpu();
+	sleep_disable();
 	return;
+}
+
+// Keep the main clock running while the system sleeps
+void sysSleepLock()
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		++sysSleepLocks;
+	}
+}
+
+// Release a sysSleepLock()
+void sysSleepUnlock()
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if(sysSleepLocks)
+			--sysSleepLocks;
+	}
 }
\ No newline at end of file
@@ -30,11 +30,19 @@
 
 #define EVENT_TYPE_TICK  EVENT_TYPE_1
 
+#define SYS_RTC_FREQ	32768UL		// Tickless sleep RTC clock (internal 32.768 kHz oscillator)
+
 // External Functions ---------------------------------------------------------
 bool sysInit();
 void sysSetTickFreq(uint16_t sysTickFreq);
 uint16_t sysGetTickFreq();
+uint32_t sysGetTickHz();
 uint32_t sysGetTickCount();
+uint32_t sysGetTickAndCount(uint16_t *count);
+uint32_t sysGetCycles();
+uint32_t sysGetTimeUs();
 void sysSleep();
+void sysSleepLock();
+void sysSleepUnlock();
 
 #endif /* SYS_H_ */
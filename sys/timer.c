@@ -0,0 +1,236 @@
+/*
+ * timer.c
+ *
+ * Implements the software timer service. Running timers are kept in a list
+ * sorted by expiry tick, so the system tick only has to check the head of the
+ * list
+ *
+ * Copyright (C) 2021 by John Anderson <racerxr650r@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR
+ * IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../avrOS.h"
+
+// Externs --------------------------------------------------------------------
+extern void *__start_TMR_TABLE,*__stop_TMR_TABLE;
+
+// Globals --------------------------------------------------------------------
+// Running timers sorted by expiry tick, the earliest at the head
+volatile static timer_t	*tmrActive = NULL, *tmrActiveTail = NULL;
+
+// Internal Functions ---------------------------------------------------------
+static void tmrAdd(volatile timer_t *timer);
+static void tmrRemove(volatile timer_t *timer);
+
+// Command line interface -----------------------------------------------------
+#ifdef TMR_CLI
+ADD_COMMAND("tmr",tmrCmd,true);
+static int tmrCmd(int argc, char *argv[])
+{
+	// Walk the table of timers
+	tmrDescriptor_t *descr = (tmrDescriptor_t *)&__start_TMR_TABLE;
+	for(; descr < (tmrDescriptor_t *)&__stop_TMR_TABLE; ++descr)
+	{
+		if(argc<2 || (argc==2 && !strcmp(descr->name,argv[1])))
+		{
+			volatile timer_t *timer = descr->timer;
+
+			printf(BOLD UNDERLINE FG_BLUE "%-20s %s\n\r" RESET,descr->name,timer->state==TMR_RUNNING?"Running":timer->state==TMR_EXPIRED?"Expired":"Idle");
+			printf("\tRemaining:%8lu\tPeriod:%8lu",tmrGetRemaining(timer),timer->period);
+#ifdef TMR_STATS
+			printf("\tExpired:%8lu",timer->expired);
+#endif
+			printf("\n\r");
+		}
+	}
+	return(0);
+}
+#endif // TMR_CLI
+
+// Internal Functions ---------------------------------------------------------
+// Insert the timer into the active list in expiry order. The list is
+// searched from the tail since new timers usually expire after the others
+static void tmrAdd(volatile timer_t *timer)
+{
+	volatile timer_t *curr = tmrActiveTail;
+
+	while(curr != NULL && (int32_t)(timer->expire - curr->expire) < 0)
+		curr = curr->prev;
+
+	// Insert after curr, or at the head if curr is NULL
+	timer->prev = curr;
+	timer->next = curr?curr->next:tmrActive;
+	if(timer->next)
+		timer->next->prev = timer;
+	else
+		tmrActiveTail = timer;
+	if(curr)
+		curr->next = timer;
+	else
+		tmrActive = timer;
+
+	timer->state = TMR_RUNNING;
+}
+
+// Remove the timer from the active list
+static void tmrRemove(volatile timer_t *timer)
+{
+	if(timer->prev)
+		timer->prev->next = timer->next;
+	else
+		tmrActive = timer->next;
+	if(timer->next)
+		timer->next->prev = timer->prev;
+	else
+		tmrActiveTail = timer->prev;
+
+	timer->next = timer->prev = NULL;
+}
+
+// External Functions ---------------------------------------------------------
+// Start (or restart) the timer to expire in the given number of ticks. If
+// period is not 0, the timer reloads and expires every period ticks after that
+void tmrStart(volatile timer_t *timer, uint32_t ticks, uint32_t period)
+{
+	// Start critical section of code
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if(timer->state == TMR_RUNNING)
+			tmrRemove(timer);
+
+		timer->expire = sysGetTickCount() + ticks;
+		timer->period = period;
+		tmrAdd(timer);
+	} // End critical section
+}
+
+// Stop the timer
+void tmrStop(volatile timer_t *timer)
+{
+	// Start critical section of code
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if(timer->state == TMR_RUNNING)
+			tmrRemove(timer);
+
+		timer->state = TMR_IDLE;
+	} // End critical section
+}
+
+// Set the function called when the timer expires. The callback is called from
+// the main loop (not interrupt) context
+void tmrSetCallback(volatile timer_t *timer, tmrCallback_t callback)
+{
+	timer->callback = callback;
+}
+
+// Return the number of ticks until the timer expires, 0 if not running
+uint32_t tmrGetRemaining(volatile timer_t *timer)
+{
+	uint32_t ret = 0;
+
+	// Start critical section of code
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if(timer->state == TMR_RUNNING && (int32_t)(timer->expire - sysGetTickCount()) > 0)
+			ret = timer->expire - sysGetTickCount();
+	} // End critical section
+
+	return(ret);
+}
+
+// On delay timer. Starts a one shot timer if it isn't running. Returns true,
+// once, after the timer has expired
+bool tmrOnDelay(volatile timer_t *timer, uint32_t ticks)
+{
+	bool ret = false;
+
+	// Start critical section of code
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if(timer->state == TMR_EXPIRED)
+		{
+			timer->state = TMR_IDLE;
+			ret = true;
+		}
+		else if(timer->state == TMR_IDLE)
+			tmrStart(timer,ticks,0);
+	} // End critical section
+
+	return(ret);
+}
+
+// Expire the timers that are due. Called from the system tick event
+void tmrUpdate(void)
+{
+	volatile timer_t	*timer;
+	uint32_t			now = sysGetTickCount();
+
+	while(1)
+	{
+		// Start critical section of code
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+		{
+			timer = tmrActive;
+			// If the earliest timer is due, remove it from the active list
+			if(timer != NULL && (int32_t)(now - timer->expire) >= 0)
+			{
+				tmrRemove(timer);
+				// If periodic, reload from the expiry tick so there's no drift
+				if(timer->period)
+				{
+					timer->expire += timer->period;
+					tmrAdd(timer);
+				}
+				else
+					timer->state = TMR_EXPIRED;
+#ifdef TMR_STATS
+				++timer->expired;
+#endif
+			}
+			else
+				timer = NULL;
+		} // End critical section
+
+		if(timer == NULL)
+			break;
+
+		evntTrigger(timer->descr->event,TMR_EVENT_EXPIRED);
+		if(timer->callback)
+			timer->callback(timer);
+	}
+}
+
+// Return true if the earliest timer is due at the given tick count
+bool tmrExpired(uint32_t tick)
+{
+	return(tmrActive != NULL && (int32_t)(tick - tmrActive->expire) >= 0);
+}
+
+// Set tick to the expiry of the earliest timer. Returns false if no timers are
+// running
+bool tmrGetNextTick(uint32_t *tick)
+{
+	bool ret = false;
+
+	// Start critical section of code
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if(tmrActive != NULL)
+		{
+			*tick = tmrActive->expire;
+			ret = true;
+		}
+	} // End critical section
+
+	return(ret);
+}
@@ -0,0 +1,92 @@
+/*
+ * timer.h
+ *
+ * Header for the software timer service. Includes the macro to create new
+ * timers (ADD_TIMER). Timers run on the system tick and trigger an event
+ * and/or call a callback when they expire
+ *
+ * Copyright (C) 2021 by John Anderson <racerxr650r@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR
+ * IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef TIMER_H_
+#define TIMER_H_
+
+// Includes -------------------------------------------------------------------
+#include "../avrOS.h"
+
+// Types ----------------------------------------------------------------------
+typedef enum
+{
+	TMR_EVENT_EXPIRED = EVENT_TYPE_1
+}tmrEvents_t;
+
+typedef enum
+{
+	TMR_IDLE = 0,		// Stopped, or never started
+	TMR_RUNNING,		// Linked into the active timer list
+	TMR_EXPIRED			// One shot timer has expired
+}tmrState_t;
+
+struct TIMER_TYPE;
+struct TMR_DESCRIPTOR_TYPE;
+
+typedef void (*tmrCallback_t)(volatile struct TIMER_TYPE *timer);
+
+typedef struct TIMER_TYPE
+{
+	uint32_t							expire;		// System tick count the timer expires on
+	uint32_t							period;		// Reload period in ticks, 0 for a one shot timer
+	tmrState_t							state;
+	tmrCallback_t						callback;	// Called when the timer expires, or NULL
+	volatile struct TIMER_TYPE			*next, *prev;
+#ifdef TMR_STATS
+	uint32_t							expired;	// Number of times the timer has expired
+#endif
+	const struct TMR_DESCRIPTOR_TYPE	*descr;
+}timer_t;
+
+typedef struct TMR_DESCRIPTOR_TYPE
+{
+	const char			*name;
+	volatile timer_t	*timer;
+	volatile event_t	*event;
+}tmrDescriptor_t;
+
+// Macros ----------------------------------------------------------------------
+#define ADD_TIMER(tmrName) \
+                  const static tmrDescriptor_t CONCAT(tmrName,_descr); \
+                  static volatile timer_t    tmrName = {.expire = 0, .period = 0, .state = TMR_IDLE, .callback = NULL, .next = NULL, .prev = NULL, .descr = &CONCAT(tmrName,_descr)}; \
+                  ADD_EVENT(tmrName ## _evnt); \
+                  const static tmrDescriptor_t SECTION(TMR_TABLE) CONCAT(tmrName,_descr) = {.name = #tmrName, .timer = &tmrName, .event = &CONCAT(tmrName,_evnt)};
+
+// External Functions ---------------------------------------------------------
+static inline volatile event_t *tmrGetEvent(volatile timer_t *timer)
+{
+	return(timer->descr->event);
+}
+
+static inline bool tmrIsRunning(volatile timer_t *timer)
+{
+	return(timer->state == TMR_RUNNING);
+}
+
+void tmrStart(volatile timer_t *timer, uint32_t ticks, uint32_t period);
+void tmrStop(volatile timer_t *timer);
+void tmrSetCallback(volatile timer_t *timer, tmrCallback_t callback);
+uint32_t tmrGetRemaining(volatile timer_t *timer);
+bool tmrOnDelay(volatile timer_t *timer, uint32_t ticks);
+void tmrUpdate(void);
+bool tmrExpired(uint32_t tick);
+bool tmrGetNextTick(uint32_t *tick);
+
+#endif /* TIMER_H_ */
@@ -0,0 +1,179 @@
+/*
+ * trace.c
+ *
+ * Implements the binary trace ring buffer and the trace CLI command
+ *
+ * Copyright (C) 2021 by John Anderson <racerxr650r@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR
+ * IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../avrOS.h"
+
+#ifdef SYS_TRACE
+// Externs --------------------------------------------------------------------
+extern void *__start_FSM_TABLE,*__stop_FSM_TABLE;
+extern void *__start_EVNT_TABLE,*__stop_EVNT_TABLE;
+extern void *__start_QUE_TABLE,*__stop_QUE_TABLE;
+
+// Globals --------------------------------------------------------------------
+static trcRecord_t		trcBuffer[TRC_BUFFER_SIZE];
+static uint16_t			trcHead = 0, trcCount = 0;
+static volatile bool	trcEnabled = true;
+
+// Command line interface -----------------------------------------------------
+#ifdef SYS_CLI
+ADD_COMMAND("trace",trcCmd,true);
+static int trcCmd(int argc, char *argv[])
+{
+	int ret = 0;
+
+	if(argc == 1)
+		printf("Trace %s, %u of %u records\n\r",trcEnabled?"running":"stopped",trcCount,TRC_BUFFER_SIZE);
+	else if(argc == 2 && !strcmp(argv[1],"start"))
+		trcStart();
+	else if(argc == 2 && !strcmp(argv[1],"stop"))
+		trcStop();
+	else if(argc == 2 && !strcmp(argv[1],"clear"))
+		trcClear();
+	else if(argc == 2 && !strcmp(argv[1],"dump"))
+		trcDump(stdout);
+	else
+		ret = -1;
+
+	return(ret);
+}
+#endif // SYS_CLI
+
+// External Functions ---------------------------------------------------------
+// Add a record to the trace ring buffer, overwriting the oldest when full
+void trcAdd(trcType_t type, uint8_t arg, uint16_t id, uint16_t data)
+{
+	trcRecord_t	*rec;
+	uint16_t	count;
+
+	if(!trcEnabled)
+		return;
+
+	// Start critical section of code
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		rec = &trcBuffer[trcHead];
+		rec->tick = (uint16_t)sysGetTickAndCount(&count);
+		rec->count = count;
+		rec->type = type;
+		rec->arg = arg;
+		rec->id = id;
+		rec->data = data;
+
+		if(++trcHead == TRC_BUFFER_SIZE)
+			trcHead = 0;
+		if(trcCount < TRC_BUFFER_SIZE)
+			++trcCount;
+	} // End critical section
+}
+
+// Start recording
+void trcStart()
+{
+	trcEnabled = true;
+}
+
+// Stop recording
+void trcStop()
+{
+	trcEnabled = false;
+}
+
+// Discard the recorded trace
+void trcClear()
+{
+	// Start critical section of code
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		trcHead = 0;
+		trcCount = 0;
+	} // End critical section
+}
+
+// Dump the trace as text. The format is read by util/trace2json:
+//   T <tick timer clock kHz> <tick timer period>
+//   N <id> <name>                        Name of a state machine, event, queue or state
+//   R <tick> <count> <type> <arg> <id> <data>   Trace record, oldest first
+//   E
+// The output queue is drained every few lines so a full trace fits through it
+void trcDump(FILE *file)
+{
+	TCB_t		*tcb = (TCB_t *)SYS_TICK_TIMER;
+	uint16_t	cpuFreq = cpuGetFrequency(), first, i, j;
+	bool		enabled = trcEnabled;
+
+	// Stop recording so the dump doesn't trace itself
+	trcEnabled = false;
+
+	fprintf(file,"T %u %u\n\r",cpuFreq==1000?cpuFreq:cpuFreq/2,tcb->CCMP);
+
+	// Name the state machines, events and queues
+	fsmStateMachineDescr_t *fsmDescr = (fsmStateMachineDescr_t *)&__start_FSM_TABLE;
+	for(; fsmDescr < (fsmStateMachineDescr_t *)&__stop_FSM_TABLE; ++fsmDescr)
+		if(fsmDescr->stateMachine != NULL)
+			fprintf(file,"N %04x %s\n\r",(unsigned)(uintptr_t)fsmDescr->stateMachine,fsmDescr->name);
+	fioBusyWaitOutput(file);
+#ifdef EVNT_STATS
+	evntDescriptor_t *evntDescr = (evntDescriptor_t *)&__start_EVNT_TABLE;
+	for(; evntDescr < (evntDescriptor_t *)&__stop_EVNT_TABLE; ++evntDescr)
+		fprintf(file,"N %04x %s\n\r",(unsigned)(uintptr_t)evntDescr->status,evntDescr->name);
+	fioBusyWaitOutput(file);
+#endif
+#ifdef QUE_STATS
+	queDescriptor_t *queDescr = (queDescriptor_t *)&__start_QUE_TABLE;
+	for(; queDescr < (queDescriptor_t *)&__stop_QUE_TABLE; ++queDescr)
+		fprintf(file,"N %04x %s\n\r",(unsigned)(uintptr_t)queDescr->queue,queDescr->name);
+	fioBusyWaitOutput(file);
+#endif
+
+	first = trcCount < TRC_BUFFER_SIZE ? 0 : trcHead;
+
+	// Name the states found in the trace, once each
+	for(i=0;i<trcCount;++i)
+	{
+		trcRecord_t *rec = &trcBuffer[(first+i)%TRC_BUFFER_SIZE];
+
+		if(rec->type == TRC_FSM_ENTER && rec->data)
+		{
+			for(j=0;j<i;++j)
+			{
+				trcRecord_t *prev = &trcBuffer[(first+j)%TRC_BUFFER_SIZE];
+				if(prev->type == TRC_FSM_ENTER && prev->data == rec->data)
+					break;
+			}
+			if(j == i)
+			{
+				fprintf(file,"N %04x %s\n\r",rec->data,(const char *)(uintptr_t)rec->data);
+				fioBusyWaitOutput(file);
+			}
+		}
+	}
+
+	// Dump the records oldest first
+	for(i=0;i<trcCount;++i)
+	{
+		trcRecord_t *rec = &trcBuffer[(first+i)%TRC_BUFFER_SIZE];
+
+		fprintf(file,"R %04x %04x %02x %02x %04x %04x\n\r",rec->tick,rec->count,rec->type,rec->arg,rec->id,rec->data);
+		if((i & 0x0f) == 0x0f)
+			fioBusyWaitOutput(file);
+	}
+	fprintf(file,"E\n\r");
+
+	trcEnabled = enabled;
+}
+#endif // SYS_TRACE
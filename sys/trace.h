@@ -0,0 +1,72 @@
+/*
+ * trace.h
+ *
+ * Header for the binary trace. Records scheduler, event, queue and interrupt
+ * activity with a timestamp into a RAM ring buffer that can be dumped over
+ * the CLI and converted to a Chrome/Perfetto trace by util/trace2json
+ *
+ * Copyright (C) 2021 by John Anderson <racerxr650r@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR
+ * IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+// Constants ------------------------------------------------------------------
+#ifndef TRC_BUFFER_SIZE
+#define TRC_BUFFER_SIZE	128		// Number of records in the trace ring buffer
+#endif
+
+// Types ----------------------------------------------------------------------
+// Trace record types. util/trace2json/trace2json.c decodes these values
+typedef enum
+{
+	TRC_NONE = 0,
+	TRC_FSM_ENTER,		// State handler call, id = state machine, data = state name
+	TRC_FSM_EXIT,		// State handler return, id = state machine, data = state name
+	TRC_EVNT_TRIGGER,	// Event triggered, id = event, arg = event type
+	TRC_EVNT_DISPATCH,	// Event handler call, id = event, arg = event type
+	TRC_QUE,			// Queue full/empty transition, id = queue, arg = queueEvents_t
+	TRC_ISR				// Interrupt entry, id = interrupt vector number
+} trcType_t;
+
+// Trace record. The timestamp is the low 16 bits of the system tick count and
+// the tick timer count, so the host can rebuild the time without a multiply
+// on the target
+typedef struct
+{
+	uint16_t	tick;
+	uint16_t	count;
+	uint8_t		type;
+	uint8_t		arg;
+	uint16_t	id;
+	uint16_t	data;
+} trcRecord_t;
+
+// Macros ---------------------------------------------------------------------
+#ifdef SYS_TRACE
+#define TRACE(type,arg,id,data)	trcAdd(type,arg,(uintptr_t)(id),(uintptr_t)(data))
+#define TRACE_ISR(vectNum)		trcAdd(TRC_ISR,0,vectNum,0)
+#else
+#define TRACE(type,arg,id,data)
+#define TRACE_ISR(vectNum)
+#endif
+
+// External Functions ---------------------------------------------------------
+void trcAdd(trcType_t type, uint8_t arg, uint16_t id, uint16_t data);
+void trcStart();
+void trcStop();
+void trcClear();
+void trcDump(FILE *file);
+
+#endif /* TRACE_H_ */
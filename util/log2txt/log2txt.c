@@ -0,0 +1,356 @@
+/*
+ * log2txt.c - Format an avrOS deferred log (LOG_FORMAT 5) on the host
+ *
+ * Compile:  gcc -Wall -o log2txt log2txt.c
+ *
+ * Usage:    log2txt elf_file input_file [output_file]
+ *	elf_file:		The application ELF file the log was captured from. The
+ *					format strings and constant strings are read from it.
+ *	input_file:		Capture of the log UART output. Lines that are not
+ *					deferred log records are copied to the output unchanged.
+ *	output_file:	Name of the text file to be created. If not provided, the
+ *					text is written to stdout.
+ *
+ * Each log call on the target sends a record line instead of the formatted
+ * message:
+ *	N <fsm> <name>							Name of a state machine by FSM_TABLE index
+ *	L <id> <tick> <level> <fsm> <args>		Log record, args are the packed argument bytes
+ * The id is the flash address of the format string. The arguments are decoded
+ * by the conversions in the format string, with the avr-gcc sizes: int and
+ * pointers are 16 bits, long and float 32 bits. %s strings are looked up in
+ * the ELF, so only constant strings can be shown.
+ *
+ * Copyright (C) 2021 by John Anderson <racerxr650r@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR
+ * IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ELF_FILE	argv[1]
+#define INPUT_FILE	argv[2]
+#define OUTPUT_FILE	argv[3]
+
+#define MAX_LINE_LEN	512
+#define MAX_ARGS_LEN	64
+#define MAX_SECTIONS	64
+#define MAX_NAMES		256
+
+// avr-gcc ELF data space addresses are offset from the flash addresses
+#define AVR_DATA_OFFSET	0x800000
+
+// LOG_NO_FSM in srv/log.h
+#define LOG_NO_FSM		0xff
+
+// ELF32 section header types and flags
+#define SHT_NOBITS		8
+#define SHF_ALLOC		2
+
+typedef struct
+{
+	uint32_t	addr;
+	uint32_t	size;
+	uint8_t		*data;
+}section_t;
+
+static uint8_t		*elf;
+static long			elfSize;
+static section_t	sections[MAX_SECTIONS];
+static int			sectionCount = 0;
+static char			*names[MAX_NAMES];
+
+// Log level names, indexed by logLevel_t
+static const char	*levels[] = {"?","CRIT","ERR ","WARN","INFO"};
+
+// Read little endian values from the ELF file
+static uint32_t get16(const uint8_t *p)
+{
+	return(p[0] | p[1]<<8);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+	return(p[0] | p[1]<<8 | p[2]<<16 | (uint32_t)p[3]<<24);
+}
+
+// Read the ELF file and find the sections loaded on the target
+static int readElf(const char *fileName)
+{
+	FILE		*file;
+	uint32_t	shoff, shentsize, shnum;
+	uint32_t	i;
+
+	if((file = fopen(fileName,"rb")) == NULL)
+		return(-1);
+	fseek(file,0,SEEK_END);
+	elfSize = ftell(file);
+	fseek(file,0,SEEK_SET);
+	elf = malloc(elfSize);
+	if(elf == NULL || fread(elf,1,elfSize,file) != (size_t)elfSize)
+	{
+		fclose(file);
+		return(-1);
+	}
+	fclose(file);
+
+	// 32 bit little endian ELF only
+	if(elfSize < 52 || memcmp(elf,"\177ELF",4) || elf[4] != 1 || elf[5] != 1)
+		return(-1);
+
+	shoff = get32(&elf[32]);
+	shentsize = get16(&elf[46]);
+	shnum = get16(&elf[48]);
+	if(shoff + shnum*shentsize > (uint32_t)elfSize)
+		return(-1);
+
+	for(i=0;i<shnum && sectionCount<MAX_SECTIONS;++i)
+	{
+		uint8_t		*sh = &elf[shoff + i*shentsize];
+		uint32_t	type = get32(&sh[4]), flags = get32(&sh[8]);
+		uint32_t	offset = get32(&sh[16]), size = get32(&sh[20]);
+
+		if((flags & SHF_ALLOC) && type != SHT_NOBITS && size && offset + size <= (uint32_t)elfSize)
+		{
+			sections[sectionCount].addr = get32(&sh[12]);
+			sections[sectionCount].size = size;
+			sections[sectionCount].data = &elf[offset];
+			++sectionCount;
+		}
+	}
+	return(0);
+}
+
+// Look up a null terminated string at an ELF address
+static const char *getString(uint32_t addr)
+{
+	int	i;
+
+	for(i=0;i<sectionCount;++i)
+	{
+		section_t *s = &sections[i];
+
+		if(addr >= s->addr && addr < s->addr + s->size && memchr(&s->data[addr - s->addr],'\0',s->addr + s->size - addr))
+			return((const char *)&s->data[addr - s->addr]);
+	}
+	return(NULL);
+}
+
+// Take size bytes of argument. Return 0 if the record is too short
+static int getArg(const uint8_t **args, const uint8_t *end, int size, uint32_t *value)
+{
+	if(*args + size > end)
+		return(0);
+	*value = size == 4 ? get32(*args) : get16(*args);
+	*args += size;
+	return(1);
+}
+
+// Format a message like avr-libc printf, taking the arguments from the record
+static void formatMessage(FILE *out, const char *fmt, const uint8_t *args, const uint8_t *end)
+{
+	char		spec[32], buff[MAX_LINE_LEN];
+	uint32_t	value;
+	int			n, longArg;
+
+	while(*fmt)
+	{
+		if(*fmt != '%')
+		{
+			fputc(*fmt++,out);
+			continue;
+		}
+
+		// Copy the flags, width and precision of the conversion
+		n = 0;
+		spec[n++] = *fmt++;
+		while(*fmt && strchr("-+ #0123456789.*",*fmt) && n < (int)sizeof(spec)-12)
+		{
+			// Substitute the width or precision argument
+			if(*fmt == '*')
+			{
+				if(!getArg(&args,end,2,&value))
+					break;
+				n += sprintf(&spec[n],"%d",(int16_t)value);
+				++fmt;
+			}
+			else
+				spec[n++] = *fmt++;
+		}
+
+		// Length modifiers, h is the same as int size
+		longArg = 0;
+		while(*fmt == 'h' || *fmt == 'l')
+			longArg |= *fmt++ == 'l';
+
+		switch(*fmt)
+		{
+			case 'd':
+			case 'i':
+				if(!getArg(&args,end,longArg?4:2,&value))
+					goto missing;
+				strcpy(&spec[n],"ld");
+				fprintf(out,spec,longArg?(long)(int32_t)value:(long)(int16_t)value);
+				break;
+			case 'u':
+			case 'o':
+			case 'x':
+			case 'X':
+				if(!getArg(&args,end,longArg?4:2,&value))
+					goto missing;
+				spec[n++] = 'l';
+				spec[n++] = *fmt;
+				spec[n] = '\0';
+				fprintf(out,spec,(unsigned long)value);
+				break;
+			case 'c':
+				if(!getArg(&args,end,2,&value))
+					goto missing;
+				strcpy(&spec[n],"c");
+				fprintf(out,spec,(int)(uint8_t)value);
+				break;
+			case 'p':
+				if(!getArg(&args,end,2,&value))
+					goto missing;
+				fprintf(out,"0x%04x",value);
+				break;
+			case 'e':
+			case 'E':
+			case 'f':
+			case 'F':
+			case 'g':
+			case 'G':
+			{
+				float	f;
+
+				if(!getArg(&args,end,4,&value))
+					goto missing;
+				memcpy(&f,&value,sizeof(f));
+				spec[n++] = *fmt;
+				spec[n] = '\0';
+				fprintf(out,spec,(double)f);
+				break;
+			}
+			// String in RAM (%s) or in flash (%S)
+			case 's':
+			case 'S':
+			{
+				const char	*str;
+
+				if(!getArg(&args,end,2,&value))
+					goto missing;
+				str = getString(*fmt == 's' ? AVR_DATA_OFFSET + value : value);
+				if(str == NULL)
+				{
+					sprintf(buff,"<0x%04x>",value);
+					str = buff;
+				}
+				strcpy(&spec[n],"s");
+				fprintf(out,spec,str);
+				break;
+			}
+			case '%':
+				fputc('%',out);
+				break;
+			case '\0':
+				return;
+			default:
+				fputc('?',out);
+				break;
+		}
+		++fmt;
+	}
+	return;
+
+missing:
+	fprintf(out,"<missing argument>");
+}
+
+int main(int argc, char *argv[])
+{
+	FILE		*in, *out = stdout;
+	char		line[MAX_LINE_LEN], hex[2*MAX_ARGS_LEN+1];
+	unsigned	id, level, fsm;
+	unsigned long tick;
+	uint8_t		args[MAX_ARGS_LEN];
+	int			argCount, i;
+
+	if(argc < 3 || argc > 4)
+	{
+		printf("Usage: log2txt elf_file input_file [output_file]\n");
+		return(-1);
+	}
+
+	if(readElf(ELF_FILE))
+	{
+		printf("Unable to read ELF file: %s\n",ELF_FILE);
+		return(-1);
+	}
+	if((in = fopen(INPUT_FILE,"r")) == NULL)
+	{
+		printf("Unable to open input file: %s\n",INPUT_FILE);
+		return(-1);
+	}
+	if(argc == 4 && (out = fopen(OUTPUT_FILE,"w")) == NULL)
+	{
+		printf("Unable to open output file: %s\n",OUTPUT_FILE);
+		fclose(in);
+		return(-1);
+	}
+
+	while(fgets(line,sizeof(line),in) != NULL)
+	{
+		char	*start = line;
+
+		// Strip the line endings, the target starts each line with "\n\r"
+		start += strspn(start,"\r");
+		start[strcspn(start,"\r\n")] = '\0';
+
+		// Name line: state machine index and name
+		if(start[0] == 'N' && sscanf(start,"N %x",&fsm) == 1 && strlen(start) > 5)
+		{
+			if(fsm < MAX_NAMES)
+			{
+				free(names[fsm]);
+				names[fsm] = strdup(&start[5]);
+			}
+		}
+		// Record line
+		else if(start[0] == 'L' && (argCount = sscanf(start,"L %x %lx %x %x %128s",&id,&tick,&level,&fsm,hex)) >= 4)
+		{
+			const char	*fmt = getString(id);
+
+			// Unpack the argument bytes
+			for(i=0;argCount == 5 && i<MAX_ARGS_LEN && sscanf(&hex[2*i],"%2hhx",&args[i]) == 1;++i)
+				;
+
+			fprintf(out,"%lu:%s:%s: ",tick,levels[level < sizeof(levels)/sizeof(levels[0]) ? level : 0],
+				fsm == LOG_NO_FSM ? "Init" : fsm < MAX_NAMES && names[fsm] != NULL ? names[fsm] : "?");
+			if(fmt != NULL)
+				formatMessage(out,fmt,args,&args[argCount == 5 ? i : 0]);
+			else
+				fprintf(out,"<unknown message 0x%04x>",id);
+			fputc('\n',out);
+		}
+		// Anything else is copied as is
+		else if(start[0] != '\0')
+			fprintf(out,"%s\n",start);
+	}
+
+	fclose(in);
+	if(out != stdout)
+		fclose(out);
+
+	return(0);
+}
@@ -0,0 +1,257 @@
+/*
+ * trace2json.c - Convert an avrOS trace dump to a Chrome/Perfetto trace
+ *                (JSON trace event format)
+ *
+ * Compile:  gcc -Wall -o trace2json trace2json.c
+ *
+ * Usage:    trace2json input_file [output_file]
+ *	input_file:		Capture of the "trace dump" CLI command output. Lines
+ *					that are not part of the dump are ignored.
+ *	output_file:	Name of the JSON file to be created. If not provided, the
+ *					JSON is written to stdout.
+ *
+ * Open the output in chrome://tracing or https://ui.perfetto.dev. Each state
+ * machine is shown as a thread with a slice per state handler call. Events,
+ * queue transitions and interrupts are shown as instant events on their own
+ * threads.
+ *
+ * Copyright (C) 2021 by John Anderson <racerxr650r@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR
+ * IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INPUT_FILE	argv[1]
+#define OUTPUT_FILE	argv[2]
+
+#define MAX_LINE_LEN	256
+#define MAX_NAMES		1024
+#define MAX_THREADS		256
+
+// Record types, must match trcType_t in sys/trace.h
+#define TRC_FSM_ENTER		1
+#define TRC_FSM_EXIT		2
+#define TRC_EVNT_TRIGGER	3
+#define TRC_EVNT_DISPATCH	4
+#define TRC_QUE				5
+#define TRC_ISR				6
+
+// Threads used for the records that don't belong to a state machine
+#define TID_EVENTS			1
+#define TID_QUEUES			2
+#define TID_INTERRUPTS		3
+
+typedef struct
+{
+	unsigned	id;
+	char		*name;
+}name_t;
+
+static name_t	names[MAX_NAMES];
+static int		nameCount = 0;
+static unsigned	threads[MAX_THREADS];
+static int		threadCount = 0;
+static int		eventCount = 0;
+
+// Queue transitions are recorded as event type bits, bit 0 first
+static const char *queEvents[] = {"empty","not empty","full","not full","above watermark","below watermark"};
+
+// Look up the name of a queue transition type bit
+static const char *getQueEvent(unsigned arg)
+{
+	unsigned	i;
+
+	for(i=0;i<sizeof(queEvents)/sizeof(queEvents[0]);++i)
+		if(arg == 1u<<i)
+			return(queEvents[i]);
+	return("?");
+}
+
+// Look up the name of a state machine, event, queue or state
+static const char *getName(unsigned id)
+{
+	static char	unknown[16];
+	int			i;
+
+	for(i=0;i<nameCount;++i)
+		if(names[i].id == id)
+			return(names[i].name);
+
+	sprintf(unknown,"0x%04x",id);
+	return(unknown);
+}
+
+// Write a string with the JSON special characters escaped
+static void writeString(FILE *out, const char *str)
+{
+	fputc('"',out);
+	for(;*str;++str)
+	{
+		if(*str == '"' || *str == '\\')
+			fputc('\\',out);
+		if((unsigned char)*str >= ' ')
+			fputc(*str,out);
+	}
+	fputc('"',out);
+}
+
+// Start a trace event object
+static void writeEvent(FILE *out, const char *name, const char *suffix, const char *ph, double ts, unsigned tid)
+{
+	char	buff[MAX_LINE_LEN];
+
+	snprintf(buff,sizeof(buff),"%s%s",name,suffix);
+	fprintf(out,"%s\n{\"name\":",eventCount++?",":"");
+	writeString(out,buff);
+	fprintf(out,",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":1,\"tid\":%u",ph,ts,tid);
+	// Instant events are scoped to their thread
+	if(ph[0] == 'i')
+		fprintf(out,",\"s\":\"t\"");
+}
+
+// Add a state machine to the list of threads to be named
+static void addThread(unsigned tid)
+{
+	int i;
+
+	for(i=0;i<threadCount;++i)
+		if(threads[i] == tid)
+			return;
+	if(threadCount < MAX_THREADS)
+		threads[threadCount++] = tid;
+}
+
+static void writeThreadName(FILE *out, unsigned tid, const char *name)
+{
+	fprintf(out,"%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":",eventCount++?",":"",tid);
+	writeString(out,name);
+	fprintf(out,"}}");
+}
+
+int main(int argc, char *argv[])
+{
+	FILE		*in, *out = stdout;
+	char		line[MAX_LINE_LEN];
+	unsigned	clock = 0, period = 0, prevTick = 0, tick, count, type, arg, id, data;
+	uint64_t	ticks = 0;
+	int			first = 1, i;
+
+	if(argc < 2 || argc > 3)
+	{
+		printf("Usage: trace2json input_file [output_file]\n");
+		return(-1);
+	}
+
+	if((in = fopen(INPUT_FILE,"r")) == NULL)
+	{
+		printf("Unable to open input file: %s\n",INPUT_FILE);
+		return(-1);
+	}
+	if(argc == 3 && (out = fopen(OUTPUT_FILE,"w")) == NULL)
+	{
+		printf("Unable to open output file: %s\n",OUTPUT_FILE);
+		fclose(in);
+		return(-1);
+	}
+
+	fprintf(out,"{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+	while(fgets(line,sizeof(line),in) != NULL)
+	{
+		// Strip the line endings
+		line[strcspn(line,"\r\n")] = '\0';
+
+		// Timer line: tick timer clock in kHz and tick period in timer counts
+		if(sscanf(line,"T %u %u",&clock,&period) == 2)
+			continue;
+		// Name line: id and name
+		else if(line[0] == 'N' && sscanf(line,"N %x",&id) == 1 && strlen(line) > 7)
+		{
+			if(nameCount < MAX_NAMES)
+			{
+				names[nameCount].id = id;
+				names[nameCount].name = strdup(&line[7]);
+				++nameCount;
+			}
+		}
+		// Record line
+		else if(sscanf(line,"R %x %x %x %x %x %x",&tick,&count,&type,&arg,&id,&data) == 6)
+		{
+			double	ts;
+
+			if(clock == 0 || period == 0)
+			{
+				fprintf(stderr,"Trace record before the timer line\n");
+				break;
+			}
+
+			// Extend the 16 bit tick count
+			if(!first)
+				ticks += (tick-prevTick) & 0xffff;
+			first = 0;
+			prevTick = tick;
+
+			// Timestamp in microseconds
+			ts = (double)(ticks*period+count)*1000.0/clock;
+
+			switch(type)
+			{
+				case TRC_FSM_ENTER:
+				case TRC_FSM_EXIT:
+					writeEvent(out,data?getName(data):"state","",type==TRC_FSM_ENTER?"B":"E",ts,id);
+					addThread(id);
+					break;
+				case TRC_EVNT_TRIGGER:
+					writeEvent(out,getName(id)," trigger","i",ts,TID_EVENTS);
+					fprintf(out,",\"args\":{\"type\":%u}",arg);
+					break;
+				case TRC_EVNT_DISPATCH:
+					writeEvent(out,getName(id)," dispatch","i",ts,TID_EVENTS);
+					fprintf(out,",\"args\":{\"type\":%u}",arg);
+					break;
+				case TRC_QUE:
+					writeEvent(out,getName(id),"","i",ts,TID_QUEUES);
+					fprintf(out,",\"args\":{\"transition\":\"%s\"}",getQueEvent(arg));
+					break;
+				case TRC_ISR:
+					sprintf(line,"ISR %u",id);
+					writeEvent(out,line,"","i",ts,TID_INTERRUPTS);
+					break;
+				default:
+					continue;
+			}
+			fprintf(out,"}");
+		}
+		// End line
+		else if(strcmp(line,"E") == 0)
+			break;
+	}
+
+	// Name the threads
+	writeThreadName(out,TID_EVENTS,"Events");
+	writeThreadName(out,TID_QUEUES,"Queues");
+	writeThreadName(out,TID_INTERRUPTS,"Interrupts");
+	for(i=0;i<threadCount;++i)
+		writeThreadName(out,threads[i],getName(threads[i]));
+
+	fprintf(out,"\n]}\n");
+
+	fclose(in);
+	if(out != stdout)
+		fclose(out);
+
+	return(0);
+}